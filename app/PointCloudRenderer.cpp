@@ -6,6 +6,7 @@
 #include "GraphicsPipeline.h"
 #include "PointCloudRenderer.h"
 
+#include <algorithm>
 #include <random>
 #include <cmath>
 
@@ -16,7 +17,7 @@ constexpr size_t initialSize = 4 * 100000;
 PointCloudRenderer::PointCloudRenderer()
   : mBVB{nullptr}
   , mModelDescriptorSet{nullptr, {}, nullptr}
-  , mSyncId{0} {
+  , mPointCapacity{initialSize / (4 * sizeof(float))} {
   mName = "PointCloud Renderer";
 }
 
@@ -26,7 +27,8 @@ PointCloudRenderer::~PointCloudRenderer() {
 
 void PointCloudRenderer::createVertexBuffer() {
   auto count = mRenderContext->getContextImageCount();
-  mSyncIds.resize(count, 0);
+  mDirtyRanges.resize(count, {0, 0});
+  mPointBuffer.resize(mPointCapacity << 2, 0.0f);
   mBVB = std::make_unique<BufferingBuffer>(mDevice,
                                            count,
                                            initialSize,
@@ -84,25 +86,83 @@ void PointCloudRenderer::createUniformBuffer() {
   }
 }
 
-void PointCloudRenderer::updateSyncId() {
-  ++mSyncId;
+void PointCloudRenderer::setPoint(int64_t id, const float* point) {
+  auto it = mIdSlots.find(id);
+  if (it == mIdSlots.end()) {
+    if (mSlotIds.size() >= mPointCapacity) {
+      //gpu buffers are reallocated without their contents, upload everything once
+      mPointCapacity <<= 1;
+      mPointBuffer.resize(mPointCapacity << 2, 0.0f);
+      for (auto& range : mDirtyRanges) {
+        range = {0, mPointCapacity};
+      }
+    }
+    it = mIdSlots.emplace(id, uint32_t(mSlotIds.size())).first;
+    mSlotIds.push_back(id);
+  }
+
+  const auto slot = it->second;
+  std::copy(point, point + 4, mPointBuffer.data() + (slot << 2));
+  markDirty(slot);
+}
+
+void PointCloudRenderer::removePoint(int64_t id) {
+  auto it = mIdSlots.find(id);
+  if (it == mIdSlots.end()) {
+    return;
+  }
+
+  //move the last point into the hole to keep the buffer dense
+  const auto slot = it->second;
+  const auto last = mSlotIds.size() - 1;
+  mIdSlots.erase(it);
+
+  if (slot != last) {
+    auto* src = mPointBuffer.data() + (last << 2);
+    std::copy(src, src + 4, mPointBuffer.data() + (slot << 2));
+    mSlotIds[slot]           = mSlotIds[last];
+    mIdSlots[mSlotIds[slot]] = slot;
+    markDirty(slot);
+  }
+
+  mSlotIds.pop_back();
+}
+
+void PointCloudRenderer::clearPoints() {
+  mSlotIds.clear();
+  mIdSlots.clear();
+}
+
+void PointCloudRenderer::markDirty(size_t slot) {
+  for (auto& [first, second] : mDirtyRanges) {
+    if (first == second) {
+      first  = slot;
+      second = slot + 1;
+      continue;
+    }
+    first  = std::min(first, slot);
+    second = std::max(second, slot + 1);
+  }
 }
 
 void PointCloudRenderer::buildCommandBuffer(vk::CommandBuffer cmd,
                                             uint32_t          idx,
                                             vk::DescriptorSet camDescSet) {
-  if (mPointBufferPtr->empty())
+  if (mSlotIds.empty())
     return;
 
-  if (mSyncIds[idx] != mSyncId) {
-    auto memorySize = sizeof(float) * mPointBufferPtr->size();
-    mBVB->update(idx, mPointBufferPtr->data(), memorySize, 0);
-    mSyncIds[idx] = mSyncId;
+  auto& [first, second] = mDirtyRanges[idx];
+  if (first < second) {
+    auto offset     = sizeof(float) * (first << 2);
+    auto memorySize = sizeof(float) * ((second - first) << 2);
+    mBVB->update(idx, mPointBuffer.data() + (first << 2), memorySize, offset);
   }
+  first  = 0;
+  second = 0;
 
   auto& vkBuffer     = mBVB->getVkBuffer(idx);
   auto& modelDescSet = mModelDescriptorSet.descSets[idx];
-  auto  vertexCount  = mPointBufferPtr->size() >> 2;
+  auto  vertexCount  = mSlotIds.size();
 
   cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, mPipeline->vk());
   cmd.bindVertexBuffers(0, {vkBuffer}, {0});
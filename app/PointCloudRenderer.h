@@ -1,5 +1,6 @@
 #pragma once
 #include <vector>
+#include <unordered_map>
 #include "RendererBase.h"
 
 namespace vkl {
@@ -13,18 +14,28 @@ public:
 
   virtual void createVertexBuffer() override;
   virtual void createUniformBuffer() override;
-  void         updateSyncId();
   void         buildCommandBuffer(vk::CommandBuffer cmd,
                                   uint32_t          idx,
                                   vk::DescriptorSet camDescSet);
 
-  void setPointCloud(std::vector<float>* pointBuffer) { mPointBufferPtr = pointBuffer; }
+  //points are xyz1, ids are stable across updates
+  void setPoint(int64_t id, const float* point);
+  void removePoint(int64_t id);
+  void clearPoints();
 
 protected:
-  std::vector<float>*              mPointBufferPtr;
-  uint32_t                         mSyncId;
-  std::vector<uint32_t>            mSyncIds;
-  std::unique_ptr<BufferingBuffer> mBVB;
+  void markDirty(size_t slot);
+
+protected:
+  //sized to the gpu buffer capacity, only the first mSlotIds.size() points are drawn
+  std::vector<float>                    mPointBuffer;
+  std::vector<int64_t>                  mSlotIds;
+  std::unordered_map<int64_t, uint32_t> mIdSlots;
+  size_t                                mPointCapacity;
+
+  //dirty slot range [first, second) per buffering index
+  std::vector<std::pair<size_t, size_t>> mDirtyRanges;
+  std::unique_ptr<BufferingBuffer>       mBVB;
 
   struct ModelDescriptorSet {
     DescriptorSetLayout*           descLayout;
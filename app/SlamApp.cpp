@@ -51,7 +51,9 @@ static std::string eigenMat(const Eigen::Matrix<Type, Row, Col>& mat, int precis
 }  //namespace
 
 SLAMApp::SLAMApp()
-  : mSensor{nullptr} {
+  : mSensor{nullptr}
+  , mLocalPathVersion{0}
+  , mMapDelta{nullptr} {
   mName       = "SLAM Application";
   mApiVersion = VK_API_VERSION_1_1;
   GLSLCompiler::set_target_environment(glslang::EShTargetSpv, glslang::EShTargetSpv_1_3);
@@ -241,7 +243,6 @@ void SLAMApp::updateUniform(int idx) {
 void SLAMApp::createPointRenderer() {
   auto* PL            = ResourcePool::requestGraphicsPipeline(PIPELINES[BASIC_POINT_PL]);
   mPointCloudRenderer = std::make_unique<PointCloudRenderer>();
-  mPointCloudRenderer->setPointCloud(&mLocalPointClouds);
   mPointCloudRenderer->prepare(mDevice.get(),
                                mRenderContext.get(),
                                mVkDescPool,
@@ -283,15 +284,46 @@ void SLAMApp::createAxisRenderer() {
 void SLAMApp::updateSLAMData() {
   auto* info = toy::SLAMInfo::getInstance();
 
-  if (info->getLocalPath(mMWcs)) {
+  auto path = info->getLocalPath();
+  if (path && path->mVersion != mLocalPathVersion) {
+    mLocalPathVersion = path->mVersion;
+    mMWcs             = path->mData;
     mAxisRenderer->updateSyncId();
     //vklLogD("current local path size : {}", mMWcs.size());
     //Eigen::Vector3f vec = mMWcs.back().block<3, 1>(0, 3);
     //vklLogD("latest frame pose : {} ", eigenVec(vec));
   }
 
-  if (info->getLocalPoints(mLocalPointClouds)) {
-    mPointCloudRenderer->updateSyncId();
+  //join with the latest full copy, then follow deltas
+  if (!mMapDelta) {
+    auto points = info->getLocalPoints();
+    if (!points)
+      return;
+
+    mPointCloudRenderer->clearPoints();
+    for (size_t i = 0; i < points->mIds.size(); ++i) {
+      mPointCloudRenderer->setPoint(points->mIds[i], points->mPoints.data() + (i << 2));
+    }
+    mMapDelta = points->mDelta;
+  }
+
+  for (auto delta = mMapDelta->next(); delta; delta = delta->next()) {
+    for (auto& id : delta->mRemovedIds) {
+      mPointCloudRenderer->removePoint(id);
+    }
+    for (size_t i = 0; i < delta->mAddedIds.size(); ++i) {
+      mPointCloudRenderer->setPoint(delta->mAddedIds[i], delta->mAddedPoints.data() + (i << 2));
+    }
+    for (size_t i = 0; i < delta->mUpdatedIds.size(); ++i) {
+      mPointCloudRenderer->setPoint(delta->mUpdatedIds[i],
+                                    delta->mUpdatedPoints.data() + (i << 2));
+    }
+    mMapDelta = delta;
+  }
+
+  //fell behind far enough that the chain was cut, rejoin from the next full copy
+  if (mMapDelta->mVersion < info->mapDeltaVersion() && !mMapDelta->next()) {
+    mMapDelta.reset();
   }
 }
 
@@ -5,6 +5,10 @@ namespace io {
 class Sensor;
 }
 
+namespace toy {
+class MapDelta;
+}
+
 namespace vkl {
 class InputCallback;
 class AxisRenderer;
@@ -42,9 +46,10 @@ protected:
 
   io::Sensor* mSensor;
 
-  std::vector<Eigen::Matrix4f> mIs;
-  std::vector<Eigen::Matrix4f> mMWcs;
-  std::vector<float>           mLocalPointClouds;
+  std::vector<Eigen::Matrix4f>         mIs;
+  std::vector<Eigen::Matrix4f>         mMWcs;
+  uint64_t                             mLocalPathVersion;
+  std::shared_ptr<const toy::MapDelta> mMapDelta;
 
   bool                           mContinousMode;
   std::unique_ptr<InputCallback> mSlamKeyCallback;
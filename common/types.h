@@ -34,6 +34,16 @@ struct CameraInfo {
   ~CameraInfo() {}
 };
 
+enum PoseType { FRONTEND = 0, REFINED = 1 };
+struct PoseOutput {
+  int64_t  frameId   = -1;
+  int      type      = PoseType::FRONTEND;
+  uint64_t ns        = 0;  //image timestamp
+  uint64_t enqueueNs = 0;  //steady clock, images handed to slam
+  uint64_t publishNs = 0;  //steady clock, pose published
+  float    Mwc[16]   = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};  //col major, cam0
+};
+
 struct ImuInfo {
   float gyrNoiseDensity{0};
   float gyrRandomWalk{0};
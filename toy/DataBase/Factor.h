@@ -13,7 +13,8 @@ class MapPoint;
 //}
 
 /**
- * @brief mappoint and frame factor
+ * @brief mappoint and frame factor. an edge of the observation graph owned by LocalMap,
+ * frame and map point are non owning and stay valid while the edge is in LocalMap.
  */
 
 class Factor {
@@ -25,29 +26,23 @@ public:
     , mFrame{nullptr}
     , mCamId{0}
     , mMapPoint{nullptr} {};
-  Factor(Type                      type,
-         std::shared_ptr<Frame>    frame,
-         size_t                    camId,
-         std::shared_ptr<MapPoint> mapPoint)
+  Factor(Type type, Frame* frame, size_t camId, MapPoint* mapPoint)
     : mType{type}
     , mFrame{frame}
     , mCamId{camId}
     , mMapPoint{mapPoint} {}
-  virtual ~Factor() {
-    mFrame    = nullptr;
-    mMapPoint = nullptr;
-  }
+  virtual ~Factor() = default;
 
 protected:
-  Type                      mType;
-  std::shared_ptr<Frame>    mFrame;
-  size_t                    mCamId;
-  std::shared_ptr<MapPoint> mMapPoint;
+  Type      mType;
+  Frame*    mFrame;
+  size_t    mCamId;
+  MapPoint* mMapPoint;
 
 public:
-  auto&                      type() { return mType; }
-  std::shared_ptr<Frame>&    frame() { return mFrame; }
-  std::shared_ptr<MapPoint>& mapPoint() { return mMapPoint; }
+  auto&     type() { return mType; }
+  Frame*    frame() const { return mFrame; }
+  MapPoint* mapPoint() const { return mMapPoint; }
 };
 
 //class ReprojectionFactor {
@@ -97,11 +92,11 @@ class ReprojectionFactor : public Factor {
 public:
   ReprojectionFactor()  = default;
   ~ReprojectionFactor() = default;
-  ReprojectionFactor(std::shared_ptr<Frame>    frame,
-                     size_t                    camId,
-                     std::shared_ptr<MapPoint> mapPoint,
-                     Eigen::Vector2d           uv,
-                     Eigen::Vector3d           unidst)
+  ReprojectionFactor(Frame*          frame,
+                     size_t          camId,
+                     MapPoint*       mapPoint,
+                     Eigen::Vector2d uv,
+                     Eigen::Vector3d unidst)
     : Factor{Type::REPROJECTION, frame, camId, mapPoint}
     , mUV{uv}
     , mUndist{unidst} {}
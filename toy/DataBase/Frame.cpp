@@ -8,24 +8,30 @@
 
 namespace toy {
 namespace db {
-int64_t Frame::globalId = 0;
+int64_t              Frame::globalId  = 0;
+std::atomic<int64_t> Frame::liveCount = 0;
 Frame::Frame(std::shared_ptr<ImagePyramidSet> set)
   : mId{globalId++}
   , mIsKeyFrame{false}
+  , mNs{set->images_[0]->ns()}
+  , mEnqueueNs{set->enqueueNs_}
   , mImagePyramids{set->images_[0], set->images_[1]}
   , mCameras{nullptr, nullptr}
   , mFeatures{std::make_unique<Feature>(), std::make_unique<Feature>()}
   , mFixed{false}
-  , mLinearized{false} {
-  mMapPointFactorMaps.resize(mImagePyramids.size());
-
+  , mLinearized{false}
+  , mPoseTracked{false} {
+  ++liveCount;
   mDelta.setZero();
   mBackupDelta.setZero();
 }
 
 Frame::Frame(Frame* src) {
+  ++liveCount;
   this->mId         = src->mId;
   this->mIsKeyFrame = src->mIsKeyFrame;
+  this->mNs         = src->mNs;
+  this->mEnqueueNs  = src->mEnqueueNs;
 
   this->mImagePyramids[0] = src->mImagePyramids[0];
   this->mImagePyramids[1] = src->mImagePyramids[1];
@@ -47,10 +53,12 @@ Frame::Frame(Frame* src) {
   this->mBackupDelta        = src->mBackupDelta;
   this->mFixed              = src->mFixed;
   this->mLinearized         = src->mLinearized;
+  this->mPoseTracked        = src->mPoseTracked;
   this->mMapPointFactorMaps = src->mMapPointFactorMaps;
 }
 
 Frame::~Frame() {
+  --liveCount;
   //for (ImagePyramid::Uni& ptr : mImagePyramids) {
   //  ptr.reset();
   //}
@@ -89,10 +97,9 @@ void Frame::setTbc(float* pfbc0, float* pfbc1) {
   mTbcs[1] = Sophus::SE3d(Qbc1, Tbc1);
 }
 
-void Frame::addMapPointFactor(std::shared_ptr<db::MapPoint> mp,
-                              ReprojectionFactor            factor) {
+void Frame::addMapPointFactor(ReprojectionFactor factor) {
   auto& idx = factor.camIdx();
-  mMapPointFactorMaps[idx].insert({mp->id(), factor});
+  mMapPointFactorMaps[idx].insert({factor.mapPoint()->id(), factor});
 }
 
 void Frame::eraseMapPointFactor(size_t mapPointId) {
@@ -101,6 +108,12 @@ void Frame::eraseMapPointFactor(size_t mapPointId) {
   }
 }
 
+void Frame::clearMapPointFactors() {
+  for (auto& mpFactorMap : mMapPointFactorMaps) {
+    mpFactorMap.clear();
+  }
+}
+
 void Frame::resetDelta() {
   mDelta.setZero();
 }
@@ -1,12 +1,13 @@
 #pragma once
 #include <array>
+#include <atomic>
 #include <memory>
-#include <map>
 
 #include <sophus/se3.hpp>
 #include <sophus/so3.hpp>
 
 #include "CustomTypes.h"
+#include "FlatMap.h"
 #include "macros.h"
 #include "Factor.h"
 
@@ -18,7 +19,8 @@ class ImagePyramidSet;
 class LocalMap;
 class Feature;
 class MapPoint;
-class Frame {
+//shared_from_this gives owners back from the non owning factor pointers
+class Frame : public std::enable_shared_from_this<Frame> {
 public:
   USING_SMART_PTR(Frame);
   DELETE_COPY_CONSTRUCTORS(Frame);
@@ -34,8 +36,9 @@ public:
   void setCameras(Camera* cam0, Camera* cam1);
   void setTbc(float*, float*);
 
-  void addMapPointFactor(std::shared_ptr<db::MapPoint> mp, ReprojectionFactor factor);
+  void addMapPointFactor(ReprojectionFactor factor);
   void eraseMapPointFactor(size_t mapPointId);
+  void clearMapPointFactors();
 
   void resetDelta();
   void backup();
@@ -54,17 +57,22 @@ public:
   }
 
 protected:
-  using MapPointFactorMap = std::map<int64_t, ReprojectionFactor>;
+  //sorted by map point id, one contiguous array per camera
+  using MapPointFactorMap = FlatMap<int64_t, ReprojectionFactor>;
+
+  static std::atomic<int64_t> liveCount;
 
   static int64_t globalId;
   int64_t        mId;
   bool           mIsKeyFrame;
+  uint64_t       mNs;
+  uint64_t       mEnqueueNs;
 
   std::array<std::shared_ptr<db::ImagePyramid>, 2> mImagePyramids;
   std::array<std::unique_ptr<Camera>, 2>           mCameras;
   std::array<std::unique_ptr<Feature>, 2>          mFeatures;
 
-  std::vector<MapPointFactorMap> mMapPointFactorMaps;
+  std::array<MapPointFactorMap, 2> mMapPointFactorMaps;
   //S : se3
   std::array<Sophus::SE3d, 2> mTbcs;
 
@@ -76,9 +84,13 @@ protected:
 
   bool mFixed;
   bool mLinearized;
+  bool mPoseTracked;  //Twb already estimated by frame to map tracking
 
 public:
+  static int64_t      instanceCount() { return liveCount; }
   const int64_t       id() const { return mId; }
+  const uint64_t      ns() const { return mNs; }
+  const uint64_t      enqueueNs() const { return mEnqueueNs; }
   void                setKeyFrame() { mIsKeyFrame = true; }
   const bool          isKeyFrame() const { return mIsKeyFrame; }
   ImagePyramid*       getImagePyramid(size_t i) { return mImagePyramids[i].get(); }
@@ -90,13 +102,16 @@ public:
   Sophus::SE3d&       getTwb() { return mTwb; }
   Sophus::SE3d        getTwc(size_t i) { return mTwb * mTbcs[i]; }
   Sophus::SE3d&       getTbc(size_t i) { return mTbcs[i]; }
-  std::vector<MapPointFactorMap>& mapPointFactorMaps() { return mMapPointFactorMaps; }
+  std::array<MapPointFactorMap, 2>& mapPointFactorMaps() { return mMapPointFactorMaps; }
   MapPointFactorMap& mapPointFactorMap(size_t i) { return mMapPointFactorMaps[i]; }
   const bool         fixed() const { return mFixed; }
   void               setFixed(bool fixed) { mFixed = fixed; }
   void               setLinearized(bool linearized) { mLinearized = linearized; }
   bool               isLinearized() { return mLinearized; }
+  void               setPoseTracked(bool tracked) { mPoseTracked = tracked; }
+  const bool         poseTracked() const { return mPoseTracked; }
   Eigen::Vector6d    getDelta() { return mDelta; };
+  void               setDelta(const Eigen::Vector6d& delta) { mDelta = delta; }
 };
 
 }  //namespace db
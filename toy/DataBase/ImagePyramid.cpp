@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <opencv2/opencv.hpp>
 #include "ImagePyramid.h"
 #include "ToyLogger.h"
@@ -5,45 +6,55 @@
 namespace toy {
 namespace db {
 cv::Ptr<cv::CLAHE> ImagePyramid::clahe = cv::createCLAHE(3.0, cv::Size(8, 8));
+std::mutex         ImagePyramid::claheLock;
 
 ImagePyramid::ImagePyramid(const ImageData& imageData)
   : mType{imageData.type}
+  , mNs{imageData.ns}
   , mW{0}
   , mH{0}
-  , mL{0} {
+  , mL{0}
+  , mMaxLevel{-1} {
   switch (mType) {
   case ImageType::NONE:
+    mOriginReady = true;
     break;
   case ImageType::CAM0:
   case ImageType::CAM1: {
-    cv::Mat in = cv::Mat(imageData.h, imageData.w, imageData.format, imageData.buffer)
-                   .clone();
-
-    convertToGray(in, mOrigin);
-    createImagePyrmid();
+    //only the copy is done here. gray conversion, equalization and levels are
+    //deferred to the tracker thread so frames dropped by its queue cost nothing.
+    mOrigin = cv::Mat(imageData.h, imageData.w, imageData.format, imageData.buffer)
+                .clone();
 
     mW = mOrigin.cols;
     mH = mOrigin.rows;
     mL = mW * mH * sizeof(uint8_t);
 
+    mMaxLevel = computeMaxLevel(mW, mH);
+    mPyramids.resize((mMaxLevel + 1) << 1);
     break;
   }
   default: {
-    cv::Mat in = cv::Mat(imageData.h, imageData.w, imageData.format, imageData.buffer);
-    mOrigin    = in;
+    cv::Mat in   = cv::Mat(imageData.h, imageData.w, imageData.format, imageData.buffer);
+    mOrigin      = in;
+    mOriginReady = true;
     break;
   }
   }
 }
 
 ImagePyramid::ImagePyramid(const ImagePyramid* src) {
-  this->mH  = src->mH;
-  mType     = src->mType;
-  mOrigin   = src->mOrigin;
-  mW        = src->mW;
-  mH        = src->mH;
-  mL        = src->mL;
-  mPyramids = src->mPyramids;
+  std::unique_lock<std::mutex> lock(src->mPyramidLock);
+  mType        = src->mType;
+  mNs          = src->mNs;
+  mOrigin      = src->mOrigin;
+  mW           = src->mW;
+  mH           = src->mH;
+  mL           = src->mL;
+  mMaxLevel    = src->mMaxLevel;
+  mPyramids    = src->mPyramids;
+  mOriginReady = src->mOriginReady.load();
+  mBuiltLevel  = src->mBuiltLevel.load();
 }
 
 ImagePyramid::~ImagePyramid() {
@@ -55,19 +66,74 @@ ImagePyramid::Ptr ImagePyramid::clone() {
   return out;
 }
 
-void ImagePyramid::createImagePyrmid() {
-  if (Config::Vio::equalizeHistogram)
-    clahe->apply(mOrigin, mOrigin);
+std::vector<cv::Mat> ImagePyramid::getPyramids(int level) {
+  level = std::min(level, mMaxLevel);
+  if (level < 0) {
+    return {};
+  }
+
+  if (mBuiltLevel.load(std::memory_order_acquire) < level) {
+    createImagePyrmid(level);
+    level = std::min(level, mBuiltLevel.load(std::memory_order_acquire));
+  }
+
+  //built slots are never written again, so copying the headers needs no lock
+  const auto end = mPyramids.begin() + ((level + 1) << 1);
+  return std::vector<cv::Mat>(mPyramids.begin(), end);
+}
+
+void ImagePyramid::prepareOrigin() {
+  if (mOriginReady.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(mPyramidLock);
+  if (mOriginReady.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  cv::Mat gray;
+  convertToGray(mOrigin, gray);
+
+  if (Config::Vio::equalizeHistogram) {
+    std::unique_lock<std::mutex> claheGuard(claheLock);
+    clahe->apply(gray, gray);
+  }
 
-  const cv::Point2i patch(Config::Vio::patchSize, Config::Vio::patchSize);
-  const int         level = Config::Vio::maxPyramidLevel;
+  mOrigin = gray;
+  mOriginReady.store(true, std::memory_order_release);
+}
+
+void ImagePyramid::createImagePyrmid(int level) {
+  prepareOrigin();
+
+  std::unique_lock<std::mutex> lock(mPyramidLock);
+
+  const int built = mBuiltLevel.load(std::memory_order_relaxed);
+  if (built >= level) {
+    return;
+  }
+
+  //every caller asks for the configured levels, so the pyramid is built in one go.
+  //a deeper request after a shallow one rebuilds from the origin.
+  const cv::Point2i    patch(Config::Vio::patchSize, Config::Vio::patchSize);
+  std::vector<cv::Mat> levels;
   cv::buildOpticalFlowPyramid(mOrigin,
-                              mPyramids,
+                              levels,
                               patch,
                               level,
                               true,
                               cv::BORDER_REFLECT_101,
                               cv::BORDER_CONSTANT);
+
+  //built slots are shared with readers, only the new levels are stored
+  const size_t start = size_t(built + 1) << 1;
+  const size_t end   = std::min(levels.size(), mPyramids.size());
+  if (end > start) {
+    std::copy(levels.begin() + start, levels.begin() + end, mPyramids.begin() + start);
+  }
+
+  mBuiltLevel.store(std::max(built, int(end >> 1) - 1), std::memory_order_release);
 }
 
 void ImagePyramid::convertToGray(cv::Mat& src, cv::Mat& dst) {
@@ -77,5 +143,17 @@ void ImagePyramid::convertToGray(cv::Mat& src, cv::Mat& dst) {
     dst = src;
 }
 
+int ImagePyramid::computeMaxLevel(int w, int h) {
+  //same stop rule as cv::buildOpticalFlowPyramid
+  const int& patch = Config::Vio::patchSize;
+  int        level = 0;
+  while (level < Config::Vio::maxPyramidLevel && w > patch && h > patch) {
+    w = (w + 1) >> 1;
+    h = (h + 1) >> 1;
+    ++level;
+  }
+  return level;
+}
+
 };  //namespace db
-}  //namespace toy
\ No newline at end of file
+}  //namespace toy
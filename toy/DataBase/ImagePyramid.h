@@ -1,6 +1,8 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <opencv2/opencv.hpp>
 #include "types.h"
 #include "macros.h"
@@ -21,30 +23,54 @@ public:
   ImagePyramid::Ptr clone();
 
 protected:
-  void        createImagePyrmid();
+  void        prepareOrigin();
+  void        createImagePyrmid(int level);
   static void convertToGray(cv::Mat& src, cv::Mat& dst);
+  static int  computeMaxLevel(int w, int h);
 
 protected:
   int                       mType;
+  uint64_t                  mNs;
   cv::Mat                   mOrigin;
   int                       mW;
   int                       mH;
   int                       mL;
+  int                       mMaxLevel;
   std::vector<cv::Mat>      mPyramids;
   static cv::Ptr<cv::CLAHE> clahe;
+  static std::mutex         claheLock;
+
+  //levels are created on first access, once.
+  mutable std::mutex mPyramidLock;
+  std::atomic<bool>  mOriginReady{false};
+  std::atomic<int>   mBuiltLevel{-1};
 
 public:
-  int                   type() { return mType; }
-  cv::Mat&              getOrigin() { return mOrigin; }
-  std::vector<cv::Mat>& getPyramids() { return mPyramids; }
+  int      type() { return mType; }
+  uint64_t ns() const { return mNs; }
+  int      maxLevel() const { return mMaxLevel; }
+  cv::Mat& getOrigin() {
+    prepareOrigin();
+    return mOrigin;
+  }
+
+  /**
+   * @brief returns levels [0, level] (image and derivative per level), building the
+   * missing ones. level is clamped to what the image size allows.
+   */
+  std::vector<cv::Mat> getPyramids(int level);
 };
 
 class ImagePyramidSet {
 public:
   using Ptr = std::shared_ptr<ImagePyramidSet>;
-  ImagePyramidSet(std::vector<ImagePyramid::Ptr>& images) { images_.swap(images); }
+  ImagePyramidSet(std::vector<ImagePyramid::Ptr>& images, uint64_t enqueueNs = 0)
+    : enqueueNs_{enqueueNs} {
+    images_.swap(images);
+  }
   std::vector<ImagePyramid::Ptr> images_;
+  uint64_t                       enqueueNs_;
 };
 
 };  //namespace db
-}  //namespace toy
\ No newline at end of file
+}  //namespace toy
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include "config.h"
 #include "ToyAssert.h"
 #include "Feature.h"
@@ -8,20 +10,30 @@
 
 namespace toy {
 namespace db {
+namespace {
+//parallax in radians above which a landmark counts as fully constrained in depth
+constexpr double PARALLAX_SATURATION = 0.05;
+}  //namespace
+
 LocalMap::LocalMap() {}
 
 LocalMap::~LocalMap() {}
 
 void LocalMap::reset() {
+  //frames may outlive the map in solver or tracker buffers
+  for (auto& [id, frame] : mFrames) {
+    frame->clearMapPointFactors();
+  }
+  for (auto& [id, mp] : mMapPoints) {
+    mRemovedMapPointIds.push_back(id);
+  }
   mFrames.clear();
   mMapPoints.clear();
   mMapPointCandidates.clear();
 }
 
 size_t LocalMap::addFrame(std::shared_ptr<Frame> frame) {
-  int frameId = frame->id();
-
-  mFrames.insert({frameId, frame});
+  mFrames.insert(frame->id(), frame);
   size_t connected = 0u;
 
   auto& features = frame->getFeatures();
@@ -33,39 +45,39 @@ size_t LocalMap::addFrame(std::shared_ptr<Frame> frame) {
       int id = keyPoints.mIds[j];
 
       MapPoint::Ptr mp;
-      auto          it = mMapPoints.find(id);
+      auto*         tracking = mMapPoints.find(id);
 
-      if (it == mMapPoints.end()) {
-        auto candIt = mMapPointCandidates.find(id);
-        if (candIt == mMapPointCandidates.end()) {
+      if (!tracking) {
+        auto* cand = mMapPointCandidates.find(id);
+        if (!cand) {
           //TOY_ASSERT_MESSAGE(i == 0, " adding mp in sub frame");
           if (i != 0) {
             continue;
           }
           mp = std::make_shared<MapPoint>(id);
-          mMapPointCandidates.insert({id, mp});
+          mMapPointCandidates.insert(id, mp);
         }
         else {
-          mp = candIt->second;
+          mp = *cand;
         }
       }
       else {
         if (i == 0) {
           ++connected;
         }
-        mp = it->second;
+        mp = *tracking;
       }
 
       auto& uv     = keyPoints.mUVs[j];
       auto& undist = keyPoints.mUndists[j];
-      auto  factor = ReprojectionFactor(frame,
+      auto  factor = ReprojectionFactor(frame.get(),
                                        i,
-                                       mp,
+                                       mp.get(),
                                         {uv.x, uv.y},
                                         {undist.x, undist.y, 1.0});
 
-      mp->addFrameFactor(frame, factor);
-      frame->addMapPointFactor(mp, factor);
+      mp->addFrameFactor(factor);
+      frame->addMapPointFactor(factor);
     }
   }
 
@@ -74,7 +86,8 @@ size_t LocalMap::addFrame(std::shared_ptr<Frame> frame) {
 
 void LocalMap::addMapPoint(std::shared_ptr<MapPoint> mp) {
   assert(mMapPoints.count(mp->id()) == 0);
-  mMapPoints.insert({mp->id(), mp});
+  mMapPoints.insert(mp->id(), mp);
+  mAddedMapPointIds.push_back(mp->id());
 }
 
 void LocalMap::getCurrentStates(std::vector<Frame::Ptr>&    frames,
@@ -98,13 +111,94 @@ void LocalMap::getCurrentStates(std::vector<Frame::Ptr>&    frames,
 
     trackingMapPoints.push_back(mp);
   }
+
+  const size_t maxCount = Config::Vio::solverMaxMapPoints;
+  if (maxCount > 0 && trackingMapPoints.size() > maxCount) {
+    selectMapPoints(trackingMapPoints, maxCount);
+  }
+}
+
+void LocalMap::selectMapPoints(std::vector<MapPoint::Ptr>& trackingMapPoints,
+                               size_t                      maxCount) {
+  const int&   rowGridCount = Config::Vio::rowGridCount;
+  const int&   colGridCount = Config::Vio::colGridCount;
+  const double gridCols     = double(Config::Vio::camInfo0.w) / colGridCount;
+  const double gridRows     = double(Config::Vio::camInfo0.h) / rowGridCount;
+  const double frameCount   = double(mFrames.size());
+
+  mSelectionCandidates.clear();
+  mSelectionCandidates.reserve(trackingMapPoints.size());
+
+  for (auto& mp : trackingMapPoints) {
+    ReprojectionFactor* first = nullptr;
+    ReprojectionFactor* last  = nullptr;
+    for (auto& [frameCamId, factor] : mp->frameFactorMap()) {
+      if (frameCamId.camId != 0) {
+        continue;
+      }
+      if (!first) {
+        first = &factor;
+      }
+      last = &factor;
+    }
+
+    //stereo only points are binned by their host position
+    Eigen::Vector2d uv = last ? last->uv() : mp->frameFactorMap().begin()->second.uv();
+    const int       c  = std::clamp(int(uv.x() / gridCols), 0, colGridCount - 1);
+    const int       r  = std::clamp(int(uv.y() / gridRows), 0, rowGridCount - 1);
+
+    double parallax = 0.0;
+    if (first != last) {
+      auto bearing = [](ReprojectionFactor* factor) -> Eigen::Vector3d {
+        auto* f = factor->frame();
+        return f->getTwb().so3() * f->getTbc(0).so3() * factor->undist().normalized();
+      };
+      const double cosine = std::clamp(bearing(first).dot(bearing(last)), -1.0, 1.0);
+      parallax            = std::acos(cosine);
+    }
+
+    //longer tracks and wider baselines constrain both depth and poses better
+    const double score = double(mp->frameFactorMap().size()) / frameCount +
+                         std::min(parallax / PARALLAX_SATURATION, 1.0);
+    mSelectionCandidates.push_back({mp, r * colGridCount + c, 0, score});
+  }
+
+  auto byScore = [](const Candidate& a, const Candidate& b) { return a.score > b.score; };
+
+  //rank inside each bin, then take the best of every bin before the second of any
+  std::sort(mSelectionCandidates.begin(),
+            mSelectionCandidates.end(),
+            [&byScore](const Candidate& a, const Candidate& b) {
+              return a.bin != b.bin ? a.bin < b.bin : byScore(a, b);
+            });
+  for (size_t i = 1; i < mSelectionCandidates.size(); ++i) {
+    auto& prev = mSelectionCandidates[i - 1];
+    auto& curr = mSelectionCandidates[i];
+    curr.rank  = curr.bin == prev.bin ? prev.rank + 1 : 0;
+  }
+
+  std::partial_sort(mSelectionCandidates.begin(),
+                    mSelectionCandidates.begin() + maxCount,
+                    mSelectionCandidates.end(),
+                    [&byScore](const Candidate& a, const Candidate& b) {
+                      return a.rank != b.rank ? a.rank < b.rank : byScore(a, b);
+                    });
+
+  trackingMapPoints.clear();
+  for (size_t i = 0; i < maxCount; ++i) {
+    trackingMapPoints.push_back(mSelectionCandidates[i].mp);
+  }
+
+  //the solver expects the id order of the map
+  std::sort(trackingMapPoints.begin(),
+            trackingMapPoints.end(),
+            [](const MapPoint::Ptr& a, const MapPoint::Ptr& b) { return a->id() < b->id(); });
 }
 
 void LocalMap::removeFrame(int64_t id) {
   TOY_ASSERT(mFrames.count(id) > 0);
 
-  auto& f                  = mFrames[id];
-  auto& mapPointFactorMaps = f->mapPointFactorMaps();
+  auto* f = mFrames.find(id)->get();
 
   std::forward_list<size_t> marginMapPointIds;
 
@@ -113,6 +207,7 @@ void LocalMap::removeFrame(int64_t id) {
 
     if (eraseMapPoint) {
       marginMapPointIds.push_front(it->first);
+      mRemovedMapPointIds.push_back(it->first);
       it = mMapPoints.erase(it);
     }
     else {
@@ -124,14 +219,15 @@ void LocalMap::removeFrame(int64_t id) {
     auto eraseMapPoint = it->second->eraseFrame(f);
 
     if (eraseMapPoint) {
-      it = mMapPointCandidates.erase(it);
       marginMapPointIds.push_front(it->first);
+      it = mMapPointCandidates.erase(it);
     }
     else {
       ++it;
     }
   }
 
+  f->clearMapPointFactors();
   mFrames.erase(id);
 
   for (auto& [fId, frame] : mFrames) {
@@ -141,5 +237,42 @@ void LocalMap::removeFrame(int64_t id) {
   }
 }
 
+void LocalMap::eraseMapPointCandidate(int64_t id) {
+  auto* mp = mMapPointCandidates.find(id);
+  TOY_ASSERT(mp);
+
+  for (auto& [frameCamId, factor] : (*mp)->frameFactorMap()) {
+    factor.frame()->eraseMapPointFactor(id);
+  }
+  (*mp)->frameFactorMap().clear();
+  mMapPointCandidates.erase(id);
+}
+
+void LocalMap::takeMapPointChanges(std::vector<int64_t>& added,
+                                   std::vector<int64_t>& removed) {
+  //swapped so both sides keep their capacity
+  added.clear();
+  removed.clear();
+  added.swap(mAddedMapPointIds);
+  removed.swap(mRemovedMapPointIds);
+}
+
+LocalMap::MemoryReport LocalMap::report() {
+  MemoryReport out;
+  out.frames        = mFrames.size();
+  out.mapPoints     = mMapPoints.size();
+  out.candidates    = mMapPointCandidates.size();
+  out.edges         = 0;
+  out.liveFrames    = Frame::instanceCount();
+  out.liveMapPoints = MapPoint::instanceCount();
+
+  for (auto& [id, frame] : mFrames) {
+    for (auto& factorMap : frame->mapPointFactorMaps()) {
+      out.edges += factorMap.size();
+    }
+  }
+  return out;
+}
+
 }  //namespace db
 }  //namespace toy
\ No newline at end of file
@@ -1,14 +1,19 @@
 #pragma once
 #include <memory>
-#include <map>
-#include <unordered_map>
 #include <forward_list>
 #include "Map.h"
+#include "SlotMap.h"
 
 namespace toy {
 namespace db {
 class Frame;
 class MapPoint;
+
+/**
+ * @brief owns frames and map points, and the observation graph between them.
+ * factors and map point hosts are raw pointers. removeFrame and eraseMapPointCandidate
+ * drop every edge of what they remove, so nothing outside refers to a released node.
+ */
 class LocalMap : public Map {
 public:
   LocalMap();
@@ -21,21 +26,54 @@ public:
                           std::vector<std::shared_ptr<MapPoint>>& trackingMapPoints);
 
   void removeFrame(int64_t id);
+  void eraseMapPointCandidate(int64_t id);
+
+  /** @brief ids promoted to or dropped from the map points since the last call */
+  void takeMapPointChanges(std::vector<int64_t>& added, std::vector<int64_t>& removed);
+
+  struct MemoryReport {
+    size_t  frames;
+    size_t  mapPoints;
+    size_t  candidates;
+    size_t  edges;
+    int64_t liveFrames;     //includes clones held by trackers and solver
+    int64_t liveMapPoints;  //more than owned here means something retains them
+  };
+  MemoryReport report();
 
 protected:
+  /**
+   * @brief keep at most maxCount landmarks spread over the image grid, the best scored
+   * of every cell first. the others are left out of this solve with their current state,
+   * they are not marked fixed.
+   */
+  void selectMapPoints(std::vector<std::shared_ptr<MapPoint>>& trackingMapPoints,
+                       size_t                                  maxCount);
 
 protected:
-  //in the case of not using sliding window, map is used for frames
-  std::map<size_t, std::shared_ptr<Frame>>    mFrames;
-  std::map<size_t, std::shared_ptr<MapPoint>> mMapPoints;
-  std::map<size_t, std::shared_ptr<MapPoint>> mMapPointCandidates;
+  using FrameMap    = SlotMap<std::shared_ptr<Frame>>;
+  using MapPointMap = SlotMap<std::shared_ptr<MapPoint>>;
+
+  //keyed by frame id and feature id, iterated in id order
+  FrameMap    mFrames;
+  MapPointMap mMapPoints;
+  MapPointMap mMapPointCandidates;
+
+  std::vector<int64_t> mAddedMapPointIds;
+  std::vector<int64_t> mRemovedMapPointIds;
+
+  struct Candidate {
+    std::shared_ptr<MapPoint> mp;
+    int                       bin;
+    int                       rank;
+    double                    score;
+  };
+  std::vector<Candidate> mSelectionCandidates;
 
 public:
-  std::map<size_t, std::shared_ptr<Frame>>&    getFrames() { return mFrames; }
-  std::map<size_t, std::shared_ptr<MapPoint>>& getMapPoints() { return mMapPoints; }
-  std::map<size_t, std::shared_ptr<MapPoint>>& getMapPointCandidiates() {
-    return mMapPointCandidates;
-  }
+  FrameMap&    getFrames() { return mFrames; }
+  MapPointMap& getMapPoints() { return mMapPoints; }
+  MapPointMap& getMapPointCandidiates() { return mMapPointCandidates; }
 };
 
 }  //namespace db
@@ -4,27 +4,25 @@
 #include "MapPoint.h"
 namespace toy {
 namespace db {
+std::atomic<int64_t> MapPoint::liveCount = 0;
 
 MapPoint::MapPoint(int64_t id)
   : mId{id}  //, mHostFrameId{-1}
   , mStatus{Status::NONE}
+  , mHostFrame{nullptr}
   , mInvDepth{1.0}
   , mBackupInvD{1.0}
   , mFixed{false} {
+  ++liveCount;
   mMarginedPwx.setZero();
 }
 
-//void MapPoint::setHost(std::shared_ptr<db::Frame> host) {
-//
-//}
-
-void MapPoint::setHost(std::shared_ptr<db::Frame> host) {
-  mHostFrame = host;
+MapPoint::~MapPoint() {
+  --liveCount;
 }
 
-void MapPoint::addFrameFactor(std::shared_ptr<db::Frame> frame,
-                              ReprojectionFactor         factor) {
-  FrameCamId key{frame->id(), factor.camIdx()};
+void MapPoint::addFrameFactor(ReprojectionFactor factor) {
+  FrameCamId key{factor.frame()->id(), factor.camIdx()};
   mFrameFactorMap.insert({key, factor});
 }
 
@@ -47,7 +45,7 @@ void MapPoint::update(const double& delta) {
   mInvDepth = std::max(1e-5, mInvDepth + delta);
 }
 
-bool MapPoint::eraseFrame(std::shared_ptr<db::Frame> frame) {
+bool MapPoint::eraseFrame(db::Frame* frame) {
   TOY_ASSERT(!mFrameFactorMap.empty());
 
   bool eraseThis = false;
@@ -1,11 +1,12 @@
 #pragma once
+#include <atomic>
 #include <memory>
 #include <unordered_map>
-#include <map>
 #include <Eigen/Dense>
 #include "macros.h"
 #include "Factor.h"
 #include "CustomTypes.h"
+#include "FlatMap.h"
 
 namespace toy {
 namespace db {
@@ -19,15 +20,16 @@ public:
 
   MapPoint() = delete;
   MapPoint(int64_t id);
+  ~MapPoint();
 
-  void addFrameFactor(std::shared_ptr<db::Frame> frame, ReprojectionFactor factor);
+  void addFrameFactor(ReprojectionFactor factor);
 
   void backup();
   void restore();
   void update(const Eigen::Vector3d& delta);
   void update(const double& delta);
 
-  bool eraseFrame(std::shared_ptr<db::Frame> frame);
+  bool eraseFrame(db::Frame* frame);
 
 protected:
 
@@ -38,28 +40,32 @@ public:
   };
 
 protected:
-  using FrameFactorMap = std::map<FrameCamId, ReprojectionFactor>;
-
-  int64_t                    mId;
-  Status                     mStatus;
-  std::shared_ptr<db::Frame> mHostFrame;
-  Eigen::Vector2d            mUndist;
-  double                     mInvDepth;
-  Eigen::Vector2d            mBackupUndist;
-  double                     mBackupInvD;
-  bool                       mFixed;
-  Eigen::Vector3d            mMarginedPwx;
-  FrameFactorMap             mFrameFactorMap;
+  //sorted by FrameCamId, observations are appended in frame order
+  using FrameFactorMap = FlatMap<FrameCamId, ReprojectionFactor>;
+
+  static std::atomic<int64_t> liveCount;
+
+  int64_t         mId;
+  Status          mStatus;
+  db::Frame*      mHostFrame;  //not owning, valid while the host is in LocalMap
+  Eigen::Vector2d mUndist;
+  double          mInvDepth;
+  Eigen::Vector2d mBackupUndist;
+  double          mBackupInvD;
+  bool            mFixed;
+  Eigen::Vector3d mMarginedPwx;
+  FrameFactorMap  mFrameFactorMap;
 
 public:
-  const int64_t id() const { return mId; }
+  static int64_t instanceCount() { return liveCount; }
+  const int64_t  id() const { return mId; }
   const Status& status() const { return mStatus; }
   void          setState(Status status) { mStatus = status; }
 
   FrameFactorMap& frameFactorMap() { return mFrameFactorMap; }
 
-  void                       setHost(std::shared_ptr<db::Frame> host);
-  std::shared_ptr<db::Frame> hostFrame() { return mHostFrame; }
+  void       setHost(db::Frame* host) { mHostFrame = host; }
+  db::Frame* hostFrame() { return mHostFrame; }
 
   const Eigen::Vector2d& undist() const { return mUndist; }
   void                   setUndist(const Eigen::Vector2d& undist) { mUndist = undist; }
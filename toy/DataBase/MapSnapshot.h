@@ -0,0 +1,28 @@
+#pragma once
+#include <memory>
+#include <unordered_map>
+#include <Eigen/Dense>
+#include <sophus/se3.hpp>
+#include "macros.h"
+
+namespace toy {
+namespace db {
+/**
+ * @brief immutable copy of the points seen by the latest window frame and its refined pose.
+ * published by LocalTracker after each window solve, read by FrameTracker.
+ */
+class MapSnapshot {
+public:
+  USING_SMART_PTR(MapSnapshot);
+
+  MapSnapshot()
+    : mFrameId{-1} {}
+  ~MapSnapshot() = default;
+
+  int64_t                                      mFrameId;
+  Sophus::SE3d                                 mTwb;
+  std::unordered_map<int64_t, Eigen::Vector3d> mPwxs;
+};
+
+}  //namespace db
+}  //namespace toy
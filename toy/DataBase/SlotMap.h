@@ -0,0 +1,205 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "ToyAssert.h"
+
+namespace toy {
+namespace db {
+/**
+ * @brief dense storage keyed by monotonically increasing ids (frame id, feature id).
+ * values live in a contiguous slot array. a handle indexes its slot directly and a
+ * generation per slot detects values erased after the handle was taken. id lookup is a
+ * hash of live ids, iteration follows id order like std::map and erase keeps iterators
+ * valid. all bookkeeping stays proportional to size() whatever the id range.
+ */
+template <typename T>
+class SlotMap {
+public:
+  using value_type = std::pair<int64_t, T>;
+
+  struct Handle {
+    uint32_t slot       = std::numeric_limits<uint32_t>::max();
+    uint32_t generation = 0;
+    bool     valid() const { return slot != std::numeric_limits<uint32_t>::max(); }
+  };
+
+  template <typename Map, typename Value>
+  class Iterator {
+  public:
+    Iterator(Map* map, size_t pos)
+      : mMap{map}
+      , mPos{pos} {
+      skip();
+    }
+
+    Value&    operator*() const { return mMap->mSlots[mMap->mOrder[mPos].slot]; }
+    Value*    operator->() const { return &mMap->mSlots[mMap->mOrder[mPos].slot]; }
+    Iterator& operator++() {
+      ++mPos;
+      skip();
+      return *this;
+    }
+    bool operator==(const Iterator& rhs) const { return mPos == rhs.mPos; }
+    bool operator!=(const Iterator& rhs) const { return mPos != rhs.mPos; }
+
+  private:
+    friend class SlotMap;
+    void skip() {
+      while (mPos < mMap->mOrder.size() && mMap->mOrder[mPos].slot == INVALID) ++mPos;
+    }
+
+    Map*   mMap;
+    size_t mPos;
+  };
+
+  using iterator       = Iterator<SlotMap, value_type>;
+  using const_iterator = Iterator<const SlotMap, const value_type>;
+
+  SlotMap() = default;
+
+  iterator       begin() { return iterator(this, 0); }
+  iterator       end() { return iterator(this, mOrder.size()); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, mOrder.size()); }
+
+  size_t size() const { return mLookup.size(); }
+  bool   empty() const { return mLookup.empty(); }
+  size_t count(int64_t id) const { return mLookup.count(id); }
+
+  value_type& front() {
+    TOY_ASSERT(!empty());
+    return *begin();
+  }
+
+  value_type& back() {
+    TOY_ASSERT(!empty());
+    size_t pos = mOrder.size();
+    while (mOrder[--pos].slot == INVALID) {}
+    return mSlots[mOrder[pos].slot];
+  }
+
+  Handle insert(int64_t id, T value) {
+    TOY_ASSERT(count(id) == 0);
+    compact();
+
+    uint32_t slot;
+    if (mFreeSlots.empty()) {
+      slot = uint32_t(mSlots.size());
+      mSlots.emplace_back(id, std::move(value));
+      mGenerations.push_back(0);
+    }
+    else {
+      slot = mFreeSlots.back();
+      mFreeSlots.pop_back();
+      mSlots[slot] = {id, std::move(value)};
+    }
+    mLookup.emplace(id, slot);
+
+    //ids mostly arrive in order, so this is an append in the common case
+    if (mOrder.empty() || mOrder.back().id < id) {
+      mOrder.push_back({id, slot});
+    }
+    else {
+      auto it = std::lower_bound(mOrder.begin(),
+                                 mOrder.end(),
+                                 id,
+                                 [](const Entry& e, int64_t key) { return e.id < key; });
+      if (it != mOrder.end() && it->id == id) {
+        it->slot = slot;
+      }
+      else {
+        mOrder.insert(it, {id, slot});
+      }
+    }
+    return {slot, mGenerations[slot]};
+  }
+
+  T* find(int64_t id) {
+    auto it = mLookup.find(id);
+    return it == mLookup.end() ? nullptr : &mSlots[it->second].second;
+  }
+
+  Handle handle(int64_t id) const {
+    auto it = mLookup.find(id);
+    return it == mLookup.end() ? Handle{} : Handle{it->second, mGenerations[it->second]};
+  }
+
+  //nullptr when the value was erased after the handle was taken
+  T* get(const Handle& h) {
+    if (!h.valid() || h.slot >= mSlots.size() || mGenerations[h.slot] != h.generation) {
+      return nullptr;
+    }
+    return &mSlots[h.slot].second;
+  }
+
+  bool erase(int64_t id) {
+    auto it = mLookup.find(id);
+    if (it == mLookup.end()) {
+      return false;
+    }
+    auto pos = std::lower_bound(mOrder.begin(),
+                                mOrder.end(),
+                                id,
+                                [](const Entry& e, int64_t key) { return e.id < key; });
+    releaseAt(size_t(pos - mOrder.begin()));
+    return true;
+  }
+
+  iterator erase(iterator it) {
+    releaseAt(it.mPos);
+    return ++it;
+  }
+
+  void clear() {
+    //generations survive so handles taken before clear stay stale
+    mFreeSlots.clear();
+    for (uint32_t slot = 0; slot < mSlots.size(); ++slot) {
+      mSlots[slot].second = T{};
+      ++mGenerations[slot];
+      mFreeSlots.push_back(slot);
+    }
+    mOrder.clear();
+    mLookup.clear();
+  }
+
+private:
+  static constexpr uint32_t INVALID = std::numeric_limits<uint32_t>::max();
+
+  struct Entry {
+    int64_t  id;
+    uint32_t slot;  //INVALID once erased, dropped by compact
+  };
+
+  void releaseAt(size_t pos) {
+    auto slot           = mOrder[pos].slot;
+    mOrder[pos].slot    = INVALID;
+    mSlots[slot].second = T{};
+    ++mGenerations[slot];
+    mFreeSlots.push_back(slot);
+    mLookup.erase(mSlots[slot].first);
+  }
+
+  //only on insert, so erase during iteration never moves positions
+  void compact() {
+    if (mOrder.size() < (size() << 1) + 64) {
+      return;
+    }
+    mOrder.erase(std::remove_if(mOrder.begin(),
+                                mOrder.end(),
+                                [](const Entry& e) { return e.slot == INVALID; }),
+                 mOrder.end());
+  }
+
+  std::vector<value_type>               mSlots;
+  std::vector<uint32_t>                 mGenerations;  //bumped on erase, checked by get
+  std::vector<uint32_t>                 mFreeSlots;
+  std::vector<Entry>                    mOrder;   //sorted by id, tombstones until compact
+  std::unordered_map<int64_t, uint32_t> mLookup;  //live id -> slot
+};
+
+}  //namespace db
+}  //namespace toy
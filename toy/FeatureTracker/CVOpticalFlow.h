@@ -12,6 +12,8 @@ public:
   ~CVOpticalFlow() = default;
 
   virtual size_t match(db::Frame* prev, db::Frame* curr) override {
+    const int& maxLevel = Config::Vio::maxPyramidLevel;
+
     if (prev == nullptr)
       return size_t(0);
 
@@ -23,7 +25,7 @@ public:
     size_t trackedCount = 0;
 
     for (size_t k = 0; k < maxIdx; ++k) {
-      auto& pyramid0    = prev->getImagePyramid(k)->getPyramids();
+      auto  pyramid0    = prev->getImagePyramid(k)->getPyramids(maxLevel);
       auto& keyPoints0  = prev->getFeature(k)->getKeypoints();
       auto& ids0        = keyPoints0.mIds;
       auto& levels0     = keyPoints0.mLevels;
@@ -34,7 +36,7 @@ public:
       if (ids0.empty())
         return size_t(0);
 
-      auto& pyramid1 = curr->getImagePyramid(k)->getPyramids();
+      auto pyramid1 = curr->getImagePyramid(k)->getPyramids(maxLevel);
 
       std::vector<cv::Point2f> uvs;
       std::vector<cv::Point2f> undists;
@@ -48,7 +50,7 @@ public:
                                statusO,
                                cv::noArray(),
                                patch,
-                               Config::Vio::maxPyramidLevel);
+                               maxLevel);
 
       //std::vector<uchar> statusE;
       //cv::Mat            I = (cv::Mat_<double>(3, 3) << 1, 0, 0, 0, 1, 0, 0, 0, 1);
@@ -67,7 +69,7 @@ public:
                                reverse_status,
                                cv::noArray(),
                                patch,
-                               Config::Vio::maxPyramidLevel);
+                               maxLevel);
 
       auto cols = pyramid0[0].cols;
       auto rows = pyramid0[0].rows;
@@ -162,7 +164,9 @@ public:
 
   virtual size_t matchStereo(db::Frame*                   frame,
                              std::shared_ptr<db::Feature> detectedFeature) override {
-    auto& pyramid0    = frame->getImagePyramid(0)->getPyramids();
+    const int& maxLevel = Config::Vio::maxPyramidLevel;
+
+    auto  pyramid0    = frame->getImagePyramid(0)->getPyramids(maxLevel);
     auto& keyPoints0  = detectedFeature->getKeypoints();
     auto& ids0        = keyPoints0.mIds;
     auto& levels0     = keyPoints0.mLevels;
@@ -170,7 +174,7 @@ public:
     auto& trackCount0 = keyPoints0.mTrackCounts;
     auto& undists0    = keyPoints0.mUndists;
 
-    auto& pyramid1 = frame->getImagePyramid(1)->getPyramids();
+    auto pyramid1 = frame->getImagePyramid(1)->getPyramids(maxLevel);
 
     const auto patch = cv::Size2i(Config::Vio::patchSize, Config::Vio::patchSize);
 
@@ -186,7 +190,7 @@ public:
                              status,
                              cv::noArray(),
                              patch,
-                             Config::Vio::maxPyramidLevel);
+                             maxLevel);
 
     std::vector<cv::Point2f> reverse_uvs;
     std::vector<uchar>       reverse_status;
@@ -198,7 +202,7 @@ public:
                              reverse_status,
                              cv::noArray(),
                              patch,
-                             Config::Vio::maxPyramidLevel);
+                             maxLevel);
 
     for (size_t i = 0; i < reverse_status.size(); ++i) {
       if (!status[i]) {
@@ -14,6 +14,8 @@ public:
   ~PatchOpticalFlow() = default;
 
   virtual size_t match(db::Frame* prev, db::Frame* curr) override {
+    const int& maxLevel = Config::Vio::maxPyramidLevel;
+
     if (prev == nullptr)
       return size_t(0u);
     auto maxIdx = 1;
@@ -24,7 +26,7 @@ public:
     size_t trackedCount = 0;
 
     for (size_t k = 0; k < maxIdx; ++k) {
-      auto& pyramid0    = prev->getImagePyramid(k)->getPyramids();
+      auto  pyramid0    = prev->getImagePyramid(k)->getPyramids(maxLevel);
       auto& keyPoints0  = prev->getFeature(k)->getKeypoints();
       auto& ids0        = keyPoints0.mIds;
       auto& levels0     = keyPoints0.mLevels;
@@ -35,7 +37,7 @@ public:
       if (ids0.empty())
         continue;
 
-      auto& pyramid1 = curr->getImagePyramid(k)->getPyramids();
+      auto pyramid1 = curr->getImagePyramid(k)->getPyramids(maxLevel);
 
       std::vector<cv::Point2f> uvs = uvs0;
       std::vector<cv::Point2f> undists;
@@ -134,7 +136,9 @@ public:
 
   virtual size_t matchStereo(db::Frame*                   frame,
                              std::shared_ptr<db::Feature> detectedFeature) override {
-    auto& pyramid0    = frame->getImagePyramid(0)->getPyramids();
+    const int& maxLevel = Config::Vio::maxPyramidLevel;
+
+    auto  pyramid0    = frame->getImagePyramid(0)->getPyramids(maxLevel);
     auto& keyPoints0  = detectedFeature->getKeypoints();
     auto& ids0        = keyPoints0.mIds;
     auto& levels0     = keyPoints0.mLevels;
@@ -142,7 +146,7 @@ public:
     auto& trackCount0 = keyPoints0.mTrackCounts;
     auto& undists0    = keyPoints0.mUndists;
 
-    auto& pyramid1 = frame->getImagePyramid(1)->getPyramids();
+    auto pyramid1 = frame->getImagePyramid(1)->getPyramids(maxLevel);
 
     std::vector<cv::Point2f> uvs = uvs0;
     std::vector<cv::Point2f> undists;
@@ -228,7 +232,9 @@ public:
   }
 
   virtual size_t matchStereo2(db::Frame* frame) {
-    auto& pyramid0    = frame->getImagePyramid(0)->getPyramids();
+    const int& maxLevel = Config::Vio::maxPyramidLevel;
+
+    auto  pyramid0    = frame->getImagePyramid(0)->getPyramids(maxLevel);
     auto& keyPoints0  = frame->getFeature(0)->getKeypoints();
     auto& ids0        = keyPoints0.mIds;
     auto& levels0     = keyPoints0.mLevels;
@@ -236,7 +242,7 @@ public:
     auto& trackCount0 = keyPoints0.mTrackCounts;
     auto& undists0    = keyPoints0.mUndists;
 
-    auto& pyramid1    = frame->getImagePyramid(1)->getPyramids();
+    auto  pyramid1    = frame->getImagePyramid(1)->getPyramids(maxLevel);
     auto& keyPoints1  = frame->getFeature(1)->getKeypoints();
     auto& ids1        = keyPoints1.mIds;
     auto& levels1     = keyPoints1.mLevels;
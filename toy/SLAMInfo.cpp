@@ -1,45 +1,119 @@
+#include "ToyAssert.h"
+#include "TimeUtil.h"
+#include "Frame.h"
 #include "SLAMInfo.h"
 
 namespace toy {
+static constexpr size_t MAX_POSE_OUTPUT = 256;
+
 SLAMInfo::SLAMInfo()
-  : mLocalPoints{}
-  , mHaveLocalPoint{false}
-  , mLocalPath{}
-  , mHaveLocalPath{false} {}
+  : mLocalPoints{nullptr}
+  , mLocalPath{nullptr}
+  , mMapDelta{std::make_shared<MapDelta>(0)}
+  , mMapDeltaVersion{0}
+  , mLocalPathVersion{0}
+  , mPoseOutputs{}
+  , mPoseCallback{nullptr}
+  , mLatestPose{nullptr} {}
 
 SLAMInfo::~SLAMInfo() {}
 
-void SLAMInfo::setLocalPoints(std::vector<float>& pts) {
-  std::unique_lock<std::mutex> lock(mLocalPointLock);
-  mLocalPoints.swap(pts);
-  mHaveLocalPoint = true;
+MapDelta::~MapDelta() {
+  //unlink iteratively, releasing a long chain recursively could overflow the stack
+  CPtr next = std::move(mNext);
+  while (next && next.use_count() == 1) {
+    CPtr after = std::move(next->mNext);
+    next       = std::move(after);
+  }
 }
 
-bool SLAMInfo::getLocalPoints(std::vector<float>& out) {
-  std::unique_lock<std::mutex> lock(mLocalPointLock);
-  if (!mHaveLocalPoint) {
-    return false;
+void SLAMInfo::setMapDelta(MapDelta::Ptr delta) {
+  TOY_ASSERT(delta->mVersion == mMapDeltaVersion + 1);
+
+  //readers holding the previous delta see the new one from here on
+  MapDelta::CPtr next = delta;
+  std::atomic_store_explicit(&mMapDelta->mNext, next, std::memory_order_release);
+  mMapDelta = next;
+  ++mMapDeltaVersion;
+
+  //a stalled reader keeps at most MAP_RESYNC_INTERVAL deltas alive
+  mLinkedDeltas.push_back(next);
+  if (mLinkedDeltas.size() > MAP_RESYNC_INTERVAL) {
+    std::atomic_store_explicit(
+      &mLinkedDeltas.front()->mNext, MapDelta::CPtr(), std::memory_order_release);
+    mLinkedDeltas.pop_front();
   }
-  out.swap(mLocalPoints);
-  mHaveLocalPoint = false;
+}
 
-  return true;
+void SLAMInfo::setLocalPoints(std::vector<int64_t>& ids, std::vector<float>& pts) {
+  LocalPoints::CPtr snapshot = std::make_shared<LocalPoints>(mMapDelta, ids, pts);
+  std::atomic_store_explicit(&mLocalPoints, snapshot, std::memory_order_release);
+}
+
+LocalPoints::CPtr SLAMInfo::getLocalPoints() const {
+  return std::atomic_load_explicit(&mLocalPoints, std::memory_order_acquire);
 }
 
 void SLAMInfo::setLocalPath(std::vector<Eigen::Matrix4f>& path) {
-  std::unique_lock<std::mutex> lock(mLocalPathLock);
-  mLocalPath.swap(path);
-  mHaveLocalPath = true;
+  LocalPath::CPtr snapshot = std::make_shared<LocalPath>(++mLocalPathVersion, path);
+  std::atomic_store_explicit(&mLocalPath, snapshot, std::memory_order_release);
 }
 
-bool SLAMInfo::getLocalPath(std::vector<Eigen::Matrix4f>& out) {
-  std::unique_lock<std::mutex> lock(mLocalPathLock);
-  if (!mHaveLocalPath) {
+LocalPath::CPtr SLAMInfo::getLocalPath() const {
+  return std::atomic_load_explicit(&mLocalPath, std::memory_order_acquire);
+}
+
+void SLAMInfo::registerPoseCallback(PoseCallback cb) {
+  std::unique_lock<std::mutex> lock(mPoseLock);
+  mPoseCallback = cb;
+}
+
+void SLAMInfo::publishPose(db::Frame* frame, PoseType type) {
+  PoseOutput pose;
+  pose.frameId   = frame->id();
+  pose.type      = type;
+  pose.ns        = frame->ns();
+  pose.enqueueNs = frame->enqueueNs();
+
+  Eigen::Map<Eigen::Matrix4f> Mwc(pose.Mwc);
+  Mwc = frame->getTwc(0).matrix().cast<float>();
+
+  PoseCallback cb;
+  {
+    std::unique_lock<std::mutex> lock(mPoseLock);
+    pose.publishNs = util::steadyNs();
+
+    //keep latest poses only when nobody polls
+    if (mPoseOutputs.size() >= MAX_POSE_OUTPUT) {
+      mPoseOutputs.pop_front();
+    }
+    mPoseOutputs.push_back(pose);
+    cb = mPoseCallback;
+
+    //frame and local tracker publish concurrently, an older frame never replaces a newer
+    auto prev = std::atomic_load_explicit(&mLatestPose, std::memory_order_relaxed);
+    if (!prev || prev->frameId <= pose.frameId) {
+      std::atomic_store_explicit(&mLatestPose,
+                                 std::make_shared<const PoseOutput>(pose),
+                                 std::memory_order_release);
+    }
+  }
+
+  if (cb) cb(pose);
+}
+
+bool SLAMInfo::getPoseOutput(PoseOutput& out) {
+  std::unique_lock<std::mutex> lock(mPoseLock);
+  if (mPoseOutputs.empty()) {
     return false;
   }
-  out.swap(mLocalPath);
-  mHaveLocalPath = false;
+  out = mPoseOutputs.front();
+  mPoseOutputs.pop_front();
   return true;
 }
 
+std::shared_ptr<const PoseOutput> SLAMInfo::getLatestPose() const {
+  return std::atomic_load_explicit(&mLatestPose, std::memory_order_acquire);
+}
+
 }  //namespace toy
\ No newline at end of file
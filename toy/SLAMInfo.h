@@ -1,19 +1,115 @@
 #pragma once
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <vector>
 #include <Eigen/Dense>
+#include "macros.h"
+#include "types.h"
 #include "Singleton.h"
 
 namespace toy {
+namespace db {
+class Frame;
+}
+
+/**
+ * @brief immutable published data. readers keep the pointer as long as they need it and
+ * compare mVersion with the last one they consumed.
+ */
+template <typename T>
+class InfoSnapshot {
+public:
+  USING_SMART_PTR(InfoSnapshot);
+
+  InfoSnapshot(uint64_t version, T& data)
+    : mVersion{version} {
+    mData.swap(data);
+  }
+
+  const uint64_t mVersion;
+  T              mData;
+};
+
+using LocalPath = InfoSnapshot<std::vector<Eigen::Matrix4f>>;
+
+/**
+ * @brief map point changes since the previous version. points are xyz1 per id.
+ * deltas are linked in publish order, a reader follows next() from the last one it applied.
+ * the link is cut once a delta is MAP_RESYNC_INTERVAL versions old, so a reader that
+ * finds no next() while mapDeltaVersion() is ahead has to rejoin from getLocalPoints().
+ */
+class MapDelta {
+public:
+  USING_SMART_PTR(MapDelta);
+
+  MapDelta(uint64_t version)
+    : mVersion{version}
+    , mNext{nullptr} {}
+
+  ~MapDelta();
+
+  CPtr next() const { return std::atomic_load_explicit(&mNext, std::memory_order_acquire); }
+  bool empty() const { return mAddedIds.empty() && mUpdatedIds.empty() && mRemovedIds.empty(); }
+
+  const uint64_t       mVersion;
+  std::vector<int64_t> mAddedIds;
+  std::vector<float>   mAddedPoints;
+  std::vector<int64_t> mUpdatedIds;
+  std::vector<float>   mUpdatedPoints;
+  std::vector<int64_t> mRemovedIds;
+
+private:
+  friend class SLAMInfo;
+  mutable CPtr mNext;
+};
+
+/**
+ * @brief every point up to mDelta, published once in a while so new readers can join.
+ */
+class LocalPoints {
+public:
+  USING_SMART_PTR(LocalPoints);
+
+  LocalPoints(MapDelta::CPtr delta, std::vector<int64_t>& ids, std::vector<float>& points)
+    : mDelta{delta} {
+    mIds.swap(ids);
+    mPoints.swap(points);
+  }
+
+  const MapDelta::CPtr mDelta;
+  std::vector<int64_t> mIds;
+  std::vector<float>   mPoints;
+};
+
 class SLAMInfo : public Singleton<SLAMInfo> {
 public:
   friend class Singleton<SLAMInfo>;
 
-  void setLocalPoints(std::vector<float>& points);
-  bool getLocalPoints(std::vector<float>& out);
+  //deltas a reader may fall behind before it has to resync, also the full copy interval
+  static constexpr uint64_t MAP_RESYNC_INTERVAL = 30;
+
+  //single producer, any number of readers. readers never block the producer
+  void              setMapDelta(MapDelta::Ptr delta);
+  void              setLocalPoints(std::vector<int64_t>& ids, std::vector<float>& points);
+  LocalPoints::CPtr getLocalPoints() const;
+  uint64_t          mapDeltaVersion() const { return mMapDeltaVersion; }
+
+  void            setLocalPath(std::vector<Eigen::Matrix4f>& paths);
+  LocalPath::CPtr getLocalPath() const;
 
-  void setLocalPath(std::vector<Eigen::Matrix4f>& paths);
-  bool getLocalPath(std::vector<Eigen::Matrix4f>& out);
+  //pose output : front end pose first, refined pose after window optimization
+  using PoseCallback = std::function<void(const PoseOutput&)>;
+  void registerPoseCallback(PoseCallback cb);
+  void publishPose(db::Frame* frame, PoseType type);
+  bool getPoseOutput(PoseOutput& out);
+
+  //pose of the newest frame published so far of any type, nullptr before the first one.
+  //readers do not take mPoseLock, the shared_ptr atomics use libstdc++'s lock pool
+  //and are not lock free
+  std::shared_ptr<const PoseOutput> getLatestPose() const;
 
   //void getMwc(float* Pwc);
 
@@ -21,12 +117,20 @@ private:
   SLAMInfo();
   ~SLAMInfo() override;
 
-  std::mutex         mLocalPointLock;
-  std::vector<float> mLocalPoints;
-  bool               mHaveLocalPoint;
+  //accessed only through std::atomic_load / std::atomic_store
+  LocalPoints::CPtr mLocalPoints;
+  LocalPath::CPtr   mLocalPath;
+
+  //latest delta and the ones still linked to it, only touched by the producer
+  MapDelta::CPtr             mMapDelta;
+  std::deque<MapDelta::CPtr> mLinkedDeltas;
+
+  std::atomic<uint64_t> mMapDeltaVersion;
+  std::atomic<uint64_t> mLocalPathVersion;
 
-  std::mutex                   mLocalPathLock;
-  std::vector<Eigen::Matrix4f> mLocalPath;
-  bool                         mHaveLocalPath;
+  std::mutex                        mPoseLock;
+  std::deque<PoseOutput>            mPoseOutputs;
+  PoseCallback                      mPoseCallback;
+  std::shared_ptr<const PoseOutput> mLatestPose;
 };
 }  //namespace toy
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include "Frame.h"
 #include "Map.h"
 #include "VioCore.h"
+#include "SLAMInfo.h"
+#include "TimeUtil.h"
 #include "Slam.h"
 #include "types.h"
 
@@ -37,6 +39,7 @@ void SLAM::prepare(const std::string& configFile) {
 }
 
 void SLAM::setNewImages(std::vector<ImageData>& images) {
+  const auto enqueueNs  = util::steadyNs();
   const auto imageCount = images.size();
 
   std::vector<db::ImagePyramid::Ptr> imagePyramids;
@@ -47,7 +50,8 @@ void SLAM::setNewImages(std::vector<ImageData>& images) {
   }
 
   db::ImagePyramidSet::Ptr imagePyramidSet = std::make_shared<db::ImagePyramidSet>(
-    imagePyramids);
+    imagePyramids,
+    enqueueNs);
 
   mVioCore->insert(imagePyramidSet);
 
@@ -59,4 +63,12 @@ void SLAM::setAcc(const uint64_t& ns, float* acc) {}
 
 void SLAM::setGyr(const uint64_t& ns, float* gyr) {}
 
+void SLAM::registerPoseCallback(std::function<void(const PoseOutput&)> cb) {
+  SLAMInfo::getInstance()->registerPoseCallback(cb);
+}
+
+bool SLAM::getPoseOutput(PoseOutput& out) {
+  return SLAMInfo::getInstance()->getPoseOutput(out);
+}
+
 }  //namespace toy
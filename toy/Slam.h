@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <functional>
 
 #include "types.h"
 #include "Singleton.h"
@@ -20,6 +21,10 @@ public:
   void setAcc(const uint64_t& ns, float* acc);
   void setGyr(const uint64_t& ns, float* gyr);
 
+  //called from tracking threads, once per frame for each PoseType
+  void registerPoseCallback(std::function<void(const PoseOutput&)> cb);
+  bool getPoseOutput(PoseOutput& out);
+
 private:
   SLAM();
   ~SLAM() override;
@@ -11,36 +11,114 @@
 #include "ToyLogger.h"
 #include "config.h"
 #include "CustomTypes.h"
+#include "Feature.h"
 #include "Frame.h"
 #include "MapPoint.h"
+#include "MapSnapshot.h"
 #include "CostFunction.h"
 
 namespace toy {
 class BasicSolver {
 public:
+  static constexpr double MIN_PARALLAX_SIN_SQ = 1e-8;
+
+  //relative poses as columns, rotation in column major (9) then translation (3)
+  using PoseColumns = Eigen::Matrix<double, 12, Eigen::Dynamic>;
+
+  /**
+   * @brief closed form two view midpoint triangulation over a batch of bearing pairs.
+   * every step runs on whole rows so it vectorizes across pairs. valid(i) holds the
+   * parallax check and the depth range check in both views for Pc0xs.col(i).
+   */
+  static void triangulate(const Eigen::Ref<const Eigen::Matrix3Xd>& undist0s,
+                          const Eigen::Ref<const Eigen::Matrix3Xd>& undist1s,
+                          const Eigen::Ref<const PoseColumns>&      Tc1c0s,
+                          Eigen::Ref<Eigen::Matrix3Xd>              Pc0xs,
+                          Eigen::Ref<Eigen::ArrayXi>                valid) {
+    using Row = Eigen::Array<double, 1, Eigen::Dynamic>;
+
+    auto R = [&](int r, int c) { return Tc1c0s.row(c * 3 + r).array(); };
+    auto t = [&](int r) { return Tc1c0s.row(9 + r).array(); };
+    auto f = [&](int r) { return undist1s.row(r).array(); };
+
+    //u = Rc1c0 * f0, bearing of c0 expressed in c1
+    Row u0 = R(0, 0) * undist0s.row(0).array() + R(0, 1) * undist0s.row(1).array() +
+             R(0, 2) * undist0s.row(2).array();
+    Row u1 = R(1, 0) * undist0s.row(0).array() + R(1, 1) * undist0s.row(1).array() +
+             R(1, 2) * undist0s.row(2).array();
+    Row u2 = R(2, 0) * undist0s.row(0).array() + R(2, 1) * undist0s.row(1).array() +
+             R(2, 2) * undist0s.row(2).array();
+
+    //min |d0 u - d1 f1 + t|^2
+    Row uu    = u0 * u0 + u1 * u1 + u2 * u2;
+    Row uf    = u0 * f(0) + u1 * f(1) + u2 * f(2);
+    Row ff    = f(0) * f(0) + f(1) * f(1) + f(2) * f(2);
+    Row ut    = u0 * t(0) + u1 * t(1) + u2 * t(2);
+    Row ft    = f(0) * t(0) + f(1) * t(1) + f(2) * t(2);
+    Row det   = uu * ff - uf * uf;
+    Row sinSq = det / (uu * ff);
+
+    Row invDet = 1.0 / det;
+    Row d0     = (uf * ft - ut * ff) * invDet;
+    Row d1     = (uu * ft - uf * ut) * invDet;
+
+    //midpoint in c1 then back to c0
+    Row m0 = 0.5 * (d0 * u0 + d1 * f(0) + t(0));
+    Row m1 = 0.5 * (d0 * u1 + d1 * f(1) + t(1));
+    Row m2 = 0.5 * (d0 * u2 + d1 * f(2) + t(2));
+
+    Row v0 = m0 - t(0);
+    Row v1 = m1 - t(1);
+    Row v2 = m2 - t(2);
+
+    Pc0xs.row(0) = (R(0, 0) * v0 + R(1, 0) * v1 + R(2, 0) * v2).matrix();
+    Pc0xs.row(1) = (R(0, 1) * v0 + R(1, 1) * v1 + R(2, 1) * v2).matrix();
+    Pc0xs.row(2) = (R(0, 2) * v0 + R(1, 2) * v1 + R(2, 2) * v2).matrix();
+
+    const auto& min = Config::Solver::basicMinDepth;
+    const auto& max = Config::Solver::basicMaxDepth;
+
+    auto z0 = Pc0xs.row(2).array();
+    valid   = ((sinSq > MIN_PARALLAX_SIN_SQ) && (d0 > 0.0) && (d1 > 0.0) && (z0 >= min) &&
+             (z0 <= max) && (m2 >= min) && (m2 <= max))
+              .transpose()
+              .cast<int>();
+  }
+
+  /**
+   * @brief single pair version of the batched midpoint triangulation above, with the same
+   * checks. fixed size only, it runs per pair inside parallel loops.
+   */
   static bool triangulate(const Eigen::Vector3d undist0,
                           const Eigen::Vector3d undist1,
                           const Sophus::SE3d&   Sc1c0,
                           Eigen::Vector3d&      out) {
-    Eigen::Matrix<double, 3, 4> P0 = Eigen::Matrix<double, 3, 4>::Identity();
-    Eigen::Matrix<double, 3, 4> P1 = Sc1c0.matrix3x4();
-    Eigen::Matrix4d             A;
-    A.row(0) = undist0[0] * P0.row(2) - undist0[2] * P0.row(0);
-    A.row(1) = undist0[1] * P0.row(2) - undist0[2] * P0.row(1);
-    A.row(2) = undist1[0] * P1.row(2) - undist1[2] * P1.row(0);
-    A.row(3) = undist1[1] * P1.row(2) - undist1[2] * P1.row(1);
-
-    Eigen::Vector4d homoPoint;
-    homoPoint = A.jacobiSvd(Eigen::ComputeFullV).matrixV().rightCols<1>();
-    out       = homoPoint.head(3) / homoPoint.w();
-
-    auto& min = Config::Solver::basicMinDepth;
-    auto& max = Config::Solver::basicMaxDepth;
-
-    if (out.z() < min || out.z() > max)
-      return false;
+    const Eigen::Matrix3d  Rc1c0 = Sc1c0.rotationMatrix();
+    const Eigen::Vector3d  t     = Sc1c0.translation();
+    const Eigen::Vector3d  u     = Rc1c0 * undist0;
+    const Eigen::Vector3d& f     = undist1;
 
-    return true;
+    //min |d0 u - d1 f1 + t|^2
+    const double uu  = u.squaredNorm();
+    const double uf  = u.dot(f);
+    const double ff  = f.squaredNorm();
+    const double ut  = u.dot(t);
+    const double ft  = f.dot(t);
+    const double det = uu * ff - uf * uf;
+
+    const double invDet = 1.0 / det;
+    const double d0     = (uf * ft - ut * ff) * invDet;
+    const double d1     = (uu * ft - uf * ut) * invDet;
+
+    //midpoint in c1 then back to c0
+    const Eigen::Vector3d m = 0.5 * (d0 * u + d1 * f + t);
+    out                     = Rc1c0.transpose() * (m - t);
+
+    const auto& min = Config::Solver::basicMinDepth;
+    const auto& max = Config::Solver::basicMaxDepth;
+
+    return det / (uu * ff) > MIN_PARALLAX_SIN_SQ && d0 > 0.0 && d1 > 0.0 &&
+           out.z() >= min && out.z() <= max && m.z() >= min && m.z() <= max;
   }
 
   static bool solveFramePose(db::Frame::Ptr curr) {
@@ -59,7 +137,7 @@ public:
       if (mp->status() != db::MapPoint::Status::TRACKING) {
         continue;
       }
-      db::Frame::Ptr   frame  = curr;
+      db::Frame*       frame  = curr.get();
       Eigen::Vector3d& undist = factor.undist();
       Sophus::SE3d&    Tbc    = frame->getTbc(0u);
 
@@ -140,6 +218,189 @@ public:
     return true;
     */
   }
+
+  /**
+   * @brief motion only optimization of curr against fixed snapshot points.
+   * curr->Twb() is the initial guess. it is restored when the result is rejected.
+   */
+  static bool solveFramePose(db::Frame* curr, const db::MapSnapshot& snapshot) {
+    auto&         keyPoints      = curr->getFeature(0)->getKeypoints();
+    Sophus::SE3d& Tbc            = curr->getTbc(0u);
+    const double& stdFocalLength = Config::Vio::standardFocalLength;
+
+    Huber huber(Config::Vio::reprojectionMEConst);
+
+    std::vector<MapPointSnapshotCost> costs;
+    costs.reserve(keyPoints.size());
+
+    const size_t keyPointSize = keyPoints.size();
+    for (size_t i = 0; i < keyPointSize; ++i) {
+      auto it = snapshot.mPwxs.find(keyPoints.mIds[i]);
+      if (it == snapshot.mPwxs.end()) {
+        continue;
+      }
+      const auto&           uv = keyPoints.mUndists[i];
+      const Eigen::Vector3d undist(uv.x, uv.y, 1.0);
+      costs.emplace_back(curr, Tbc, it->second, undist, &huber, stdFocalLength);
+    }
+
+    if (costs.size() < size_t(Config::Vio::minTrackedPoint)) {
+      return false;
+    }
+
+    constexpr int    maxIter       = 4;
+    constexpr double minLambda     = 1e-6;
+    constexpr double maxLambda     = 1e2;
+    constexpr double inlierErrorSq = 9.0;  //3 pixel in standard focal length
+
+    curr->backup();
+
+    auto linearize = [&costs](bool updateJacobian) {
+      double err = 0.0;
+      for (auto& cost : costs) {
+        err += cost.linearlize(updateJacobian);
+      }
+      return err;
+    };
+
+    double lambda = minLambda;
+    double err    = linearize(true);
+
+    for (int iter = 0; iter < maxIter; iter++) {
+      Eigen::Matrix66d JtJ = Eigen::Matrix66d::Zero();
+      Eigen::Vector6d  JtC = Eigen::Vector6d::Zero();
+
+      for (auto& cost : costs) {
+        auto&            J   = cost.J_f0();
+        auto&            Res = cost.Res();
+        Eigen::Matrix62d Jt  = J.transpose();
+        JtJ += Jt * J;
+        JtC -= Jt * Res;
+      }
+
+      Eigen::Vector6d D = JtJ.diagonal();
+      D *= lambda;
+      JtJ.diagonal().array() += D.array().max(lambda);
+      Eigen::Vector6d delX = JtJ.ldlt().solve(JtC);
+
+      if (!delX.array().isFinite().all()) {
+        curr->restore();
+        return false;
+      }
+
+      curr->update(delX);
+
+      //a step raising the cost is undone and retried with more damping
+      const double newErr = linearize(false);
+      if (newErr >= err) {
+        curr->update(-delX);
+        lambda *= 10.0;
+        if (lambda > maxLambda) {
+          break;
+        }
+        continue;
+      }
+
+      lambda = std::max(minLambda, lambda * 0.1);
+      if (delX.array().abs().maxCoeff() < 1e-6) {
+        break;
+      }
+      err = linearize(true);
+    }
+
+    int inlierCount = 0;
+    for (auto& cost : costs) {
+      inlierCount += cost.isInlier(inlierErrorSq);
+    }
+
+    if (inlierCount < Config::Vio::minTrackedPoint) {
+      curr->restore();
+      return false;
+    }
+
+    return true;
+  }
+
+  /**
+   * @brief a few gauss newton steps on the map point alone, observing frames are fixed.
+   * a step raising the cost is undone.
+   */
+  static void refineMapPoint(db::MapPoint* mp) {
+    if (mp->fixed()) {
+      return;
+    }
+
+    const double&      stdFocalLength = Config::Vio::standardFocalLength;
+    const Sophus::SE3d Twc0           = mp->hostFrame()->getTwc(0);
+
+    Huber huber(Config::Vio::reprojectionMEConst);
+
+    //inverse depth point, Pc1 ~ Rc1c0 * (ux, uy, 1) + invD * tc1c0
+    auto linearize = [&](Eigen::Matrix3d* H, Eigen::Vector3d* b) {
+      const Eigen::Vector3d X(mp->undist().x(), mp->undist().y(), 1.0);
+      const double          invD = mp->invDepth();
+
+      double err = 0.0;
+      for (auto& [frameCamId, factor] : mp->frameFactorMap()) {
+        const Sophus::SE3d     Twc1  = factor.frame()->getTwc(factor.camIdx());
+        const Sophus::SE3d     Tc1c0 = Twc1.inverse() * Twc0;
+        const Eigen::Matrix3d  R     = Tc1c0.rotationMatrix();
+        const Eigen::Vector3d& t     = Tc1c0.translation();
+        const Eigen::Vector3d  Q     = R * X + invD * t;
+        if (Q.z() <= 0.0) {
+          return std::numeric_limits<double>::infinity();
+        }
+
+        const double          iz = 1.0 / Q.z();
+        const Eigen::Vector2d r =
+          stdFocalLength * (Q.head<2>() * iz - factor.undist().head<2>());
+        auto [error, weight] = huber.computeError(r.squaredNorm());
+        err += error;
+
+        if (H) {
+          Eigen::Matrix<double, 2, 3> dProj;
+          dProj << iz, 0.0, -Q.x() * iz * iz, 0.0, iz, -Q.y() * iz * iz;
+          Eigen::Matrix3d dQ;
+          dQ << R.col(0), R.col(1), t;
+
+          const Eigen::Matrix<double, 2, 3> J = stdFocalLength * dProj * dQ;
+          *H += weight * J.transpose() * J;
+          *b -= weight * J.transpose() * r;
+        }
+      }
+      return err;
+    };
+
+    constexpr int    maxIter = 3;
+    constexpr double lambda  = 1e-6;
+
+    Eigen::Matrix3d H;
+    Eigen::Vector3d b;
+    for (int iter = 0; iter < maxIter; iter++) {
+      H.setZero();
+      b.setZero();
+      const double err = linearize(&H, &b);
+      if (!std::isfinite(err)) {
+        return;
+      }
+
+      H.diagonal().array() += lambda;
+      const Eigen::Vector3d delX = H.ldlt().solve(b);
+      if (!delX.array().isFinite().all()) {
+        return;
+      }
+
+      mp->backup();
+      mp->update(delX);
+      if (linearize(nullptr, nullptr) >= err) {
+        mp->restore();
+        return;
+      }
+      if (delX.array().abs().maxCoeff() < 1e-6) {
+        return;
+      }
+    }
+  }
 };
 }  //namespace toy
    /*
@@ -0,0 +1,157 @@
+#pragma once
+#include <utility>
+#include <vector>
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include "ToyAssert.h"
+
+namespace toy {
+/**
+ * @brief reduced camera system kept as 6x6 frame blocks. only the upper triangle of the
+ * touched block pairs is stored, the pattern is built first and values are accumulated
+ * into it. frames are addressed by their column in the reduced system.
+ */
+template <typename Scalar>
+class BlockHessian {
+public:
+  static constexpr int BLOCK_SIZE = 6;
+  using Block                     = Eigen::Matrix<Scalar, BLOCK_SIZE, BLOCK_SIZE>;
+  using VectorX                   = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+  using BlockPair                 = std::pair<int, int>;
+
+  BlockHessian()
+    : mBlockCount{0} {}
+
+  /** @brief drop the pattern, every diagonal block is always present */
+  void resetPattern(size_t blockCount) {
+    mBlockCount = blockCount;
+    mIndex.assign(blockCount * blockCount, -1);
+    mPattern.clear();
+    for (size_t i = 0; i < blockCount; ++i) {
+      addPair(i, i);
+    }
+  }
+
+  /** @brief all block pairs between the given frame columns */
+  void addPattern(const std::vector<size_t>& cols) {
+    for (size_t i = 0; i < cols.size(); ++i) {
+      for (size_t j = i; j < cols.size(); ++j) {
+        addPair(cols[i] / BLOCK_SIZE, cols[j] / BLOCK_SIZE);
+      }
+    }
+  }
+
+  /** @brief a dense prior over the leading columns */
+  void addDensePattern(size_t cols) {
+    const size_t blocks = cols / BLOCK_SIZE;
+    for (size_t i = 0; i < blocks; ++i) {
+      for (size_t j = i; j < blocks; ++j) {
+        addPair(i, j);
+      }
+    }
+  }
+
+  template <typename Other>
+  void setPattern(const BlockHessian<Other>& src) {
+    mBlockCount = src.mBlockCount;
+    mIndex      = src.mIndex;
+    mPattern    = src.mPattern;
+  }
+
+  void setZero() {
+    mBlocks.assign(mPattern.size(), Block::Zero());
+    mB.setZero(mBlockCount * BLOCK_SIZE);
+  }
+
+  /** @brief H(col0, col1) += block, the lower block is folded into the upper one */
+  template <typename Derived>
+  void add(size_t col0, size_t col1, const Eigen::MatrixBase<Derived>& block) {
+    if (col0 <= col1) {
+      mBlocks[index(col0, col1)].noalias() += block;
+    }
+    else {
+      mBlocks[index(col1, col0)].noalias() += block.transpose();
+    }
+  }
+
+  /** @brief upper blocks of a dense system over the leading columns */
+  void addDense(const Eigen::MatrixXd& H, const Eigen::VectorXd& B) {
+    const size_t blocks = H.cols() / BLOCK_SIZE;
+    for (size_t i = 0; i < blocks; ++i) {
+      for (size_t j = i; j < blocks; ++j) {
+        mBlocks[index(i * BLOCK_SIZE, j * BLOCK_SIZE)] +=
+          H.block<BLOCK_SIZE, BLOCK_SIZE>(i * BLOCK_SIZE, j * BLOCK_SIZE).cast<Scalar>();
+      }
+    }
+    mB.head(B.size()) += B.cast<Scalar>();
+  }
+
+  /** @brief sum of a system with the same pattern, e.g. a per thread accumulator */
+  template <typename Other>
+  void add(const BlockHessian<Other>& src) {
+    TOY_ASSERT(src.mBlocks.size() == mBlocks.size());
+    for (size_t i = 0; i < mBlocks.size(); ++i) {
+      mBlocks[i] += src.mBlocks[i].template cast<Scalar>();
+    }
+    mB += src.mB.template cast<Scalar>();
+  }
+
+  VectorX&       b() { return mB; }
+  const VectorX& b() const { return mB; }
+
+  const std::vector<BlockPair>& pattern() const { return mPattern; }
+
+  /** @brief full symmetric sparse matrix of the stored blocks */
+  void toSparse(Eigen::SparseMatrix<double>& H, std::vector<Eigen::Triplet<double>>& triplets) {
+    triplets.clear();
+    triplets.reserve(mPattern.size() * BLOCK_SIZE * BLOCK_SIZE * 2);
+
+    for (size_t k = 0; k < mPattern.size(); ++k) {
+      const auto& [bi, bj] = mPattern[k];
+      const auto& block    = mBlocks[k];
+      const int   r0       = bi * BLOCK_SIZE;
+      const int   c0       = bj * BLOCK_SIZE;
+
+      for (int c = 0; c < BLOCK_SIZE; ++c) {
+        for (int r = 0; r < BLOCK_SIZE; ++r) {
+          triplets.emplace_back(r0 + r, c0 + c, double(block(r, c)));
+          if (bi != bj) {
+            triplets.emplace_back(c0 + c, r0 + r, double(block(r, c)));
+          }
+        }
+      }
+    }
+
+    const int size = mBlockCount * BLOCK_SIZE;
+    H.resize(size, size);
+    H.setFromTriplets(triplets.begin(), triplets.end());
+  }
+
+private:
+  template <typename>
+  friend class BlockHessian;
+
+  void addPair(size_t b0, size_t b1) {
+    if (b0 > b1) {
+      std::swap(b0, b1);
+    }
+    auto& idx = mIndex[b0 * mBlockCount + b1];
+    if (idx < 0) {
+      idx = mPattern.size();
+      mPattern.emplace_back(b0, b1);
+    }
+  }
+
+  int index(size_t col0, size_t col1) const {
+    const int idx = mIndex[(col0 / BLOCK_SIZE) * mBlockCount + col1 / BLOCK_SIZE];
+    TOY_ASSERT(idx >= 0);
+    return idx;
+  }
+
+  size_t                 mBlockCount;
+  std::vector<int>       mIndex;  //dense block index, the window only has tens of frames
+  std::vector<BlockPair> mPattern;
+  std::vector<Block>     mBlocks;
+  VectorX                mB;
+};
+}  //namespace toy
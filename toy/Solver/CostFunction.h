@@ -17,6 +17,8 @@ public:
 
   virtual std::tuple<double, double> computeError(double errorSq) = 0;
 
+  double constant() const { return mRes; }
+
 protected:
   double mRes;  //constant
 };
@@ -111,9 +113,9 @@ class PoseOnlyReporjectinCost {
 public:
   USING_SMART_PTR(PoseOnlyReporjectinCost);
   PoseOnlyReporjectinCost() = delete;
-  PoseOnlyReporjectinCost(db::Frame::Ptr         f0,
+  PoseOnlyReporjectinCost(db::Frame*             f0,
                           Sophus::SE3d&          Tbc,
-                          db::MapPoint::Ptr      mp,
+                          db::MapPoint*          mp,
                           const Eigen::Vector3d& maesurement,
                           MEstimator::Ptr        ME,
                           double                 sqrtInfo = 640.0)
@@ -141,7 +143,7 @@ public:
     Eigen::Vector2d cost  = mSqrtInfo * (nPc1x - mZ).head(2);
 
     double cSq    = cost.squaredNorm();
-    double errSq  = cSq;
+    double errSq  = 0.5 * cSq;
     double weight = 1.0;
 
     if (mME) {
@@ -179,10 +181,10 @@ public:
   }
 
 protected:
-  db::Frame::Ptr mF;
-  Sophus::SE3d   mTcb;
+  db::Frame*   mF;
+  Sophus::SE3d mTcb;
 
-  db::MapPoint::Ptr mMp;
+  db::MapPoint* mMp;
 
   Eigen::Vector3d mZ;  //measurement
 
@@ -195,59 +197,41 @@ protected:
 public:
   const Eigen::Vector2d&  Res() const { return mRes; }
   const Eigen::Matrix26d& J_f0() const { return mJ_f0; }
-  db::Frame::Ptr          getFrame() { return mF; }
+  db::Frame*              getFrame() { return mF; }
 };
 
-class ReprojectionCost {
+/**
+ * @brief pose only reprojection of a fixed world point, for frame to map tracking
+ */
+class MapPointSnapshotCost {
 public:
-  USING_SMART_PTR(ReprojectionCost);
-  ReprojectionCost() = delete;
-  ReprojectionCost(db::Frame::Ptr         fs0,
-                   Sophus::SE3d&          Tb0c0,
-                   db::Frame::Ptr         fs1,
-                   Sophus::SE3d&          Tb1c1,
-                   db::MapPoint::Ptr      mp,
-                   const Eigen::Vector3d& maesurement,
-                   MEstimator::Ptr        ME,
-                   double                 sqrtInfo = 640.0)
-    : mF0{fs0}
-    , mF1{fs1}
-    , mMp{mp}
+  MapPointSnapshotCost() = delete;
+  MapPointSnapshotCost(db::Frame*             f0,
+                       const Sophus::SE3d&    Tbc,
+                       const Eigen::Vector3d& Pwx,
+                       const Eigen::Vector3d& maesurement,
+                       MEstimator*            ME,
+                       double                 sqrtInfo = 640.0)
+    : mF{f0}
+    , mTcb{Tbc.inverse()}
+    , mPwx{Pwx}
     , mZ{maesurement}
     , mME{ME}
     , mSqrtInfo{sqrtInfo} {
-    mRb0c0 = Tb0c0.rotationMatrix();
-    mPb0c0 = Tb0c0.translation();
-
-    auto Tc1b1 = Tb1c1.inverse();
-    mRc1b1     = Tc1b1.rotationMatrix();
-    mPc1b1     = Tc1b1.translation();
+    mRes.setZero();
+    mJ_f0.setZero();
   }
 
-  virtual double linearlize(bool updateJacobian) {
-    const Sophus::SE3d& Twb0 = mF0->Twb();
-    const Sophus::SE3d  Tb1w = mF1->Twb().inverse();
-
-    const Eigen::Matrix3d Rwb0 = Twb0.rotationMatrix();
-    const Eigen::Vector3d Pwb0 = Twb0.translation();
-    const Eigen::Matrix3d Rb1w = Tb1w.rotationMatrix();
-    const Eigen::Vector3d Pb1w = Tb1w.translation();
-
-    const double&         invD   = mMp->invDepth();
-    const double          D      = 1.0 / invD;
-    const auto&           undist = mMp->undist();
-    const Eigen::Vector3d undist3d(undist.x(), undist.y(), 1.0);
-
-    Eigen::Vector3d Pc0x = undist3d * D;
-    Eigen::Vector3d Pb0x = mRb0c0 * Pc0x + mPb0c0;
-    Eigen::Vector3d Pb1x = Rb1w * (Rwb0 * Pb0x + Pwb0) + Pb1w;
-    Eigen::Vector3d Pc1x = mRc1b1 * Pb1x + mPc1b1;
+  double linearlize(bool updateState) {
+    const Sophus::SE3d    Tbw = mF->Twb().inverse();
+    const Eigen::Vector3d Pbx = Tbw * mPwx;
+    const Eigen::Vector3d Pcx = mTcb * Pbx;
 
-    double z  = Pc1x.z();
+    double z  = Pcx.z();
     double iz = 1.0 / z;
 
-    Eigen::Vector3d nPc1x = Pc1x * iz;
-    Eigen::Vector2d cost  = mSqrtInfo * (nPc1x - mZ).head(2);
+    Eigen::Vector3d nPcx = Pcx * iz;
+    Eigen::Vector2d cost = mSqrtInfo * (nPcx - mZ).head(2);
 
     double cSq    = cost.squaredNorm();
     double errSq  = cSq;
@@ -257,198 +241,126 @@ public:
       std::tie(errSq, weight) = mME->computeError(cSq);
     }
 
-    if (updateJacobian) {
+    if (updateState) {
+      Eigen::Matrix3d Rcb = mTcb.so3().matrix();
+      Eigen::Matrix3d Rcw = Rcb * Tbw.so3().matrix();
+
       double sqrtW = std::sqrt(weight);
 
       mRes = sqrtW * cost;
 
       double           izSq = iz * iz;
       Eigen::Matrix23d reduce;
-      reduce << iz, 0.0, -Pc1x.x() * izSq, 0.0, iz, -Pc1x.y() * izSq;
-
-      double totalSqrtInfo = sqrtW * mSqrtInfo;
-
-      Eigen::Matrix3d Rc1w  = mRc1b1 * Rb1w;
-      Eigen::Matrix3d Rc1b0 = Rc1w * Rwb0;
+      reduce << iz, 0.0, -Pcx.x() * izSq, 0.0, iz, -Pcx.y() * izSq;
 
       Eigen::Matrix36d J;
-
-      if (mF0->fixed()) {
-        mJ_f0.setZero();
-      }
-      else {
-        J.block<3, 3>(0, 0) = Rc1w;
-        J.block<3, 3>(0, 3) = -Rc1b0 * Eigen::skew(Pb0x);
-        mJ_f0               = totalSqrtInfo * reduce * J;
-      }
-
-      if (mF1->fixed()) {
-        mJ_f1.setZero();
-      }
-      else {
-        J.block<3, 3>(0, 0) = -Rc1w;
-        J.block<3, 3>(0, 3) = mRc1b1 * Eigen::skew(Pb1x);
-        mJ_f1               = totalSqrtInfo * reduce * J;
-      }
-
-      if (mMp->fixed()) {
-        mJ_mp.setZero();
-      }
-      else {
-        Eigen::Matrix3d Rc1c0 = Rc1b0 * mRb0c0;
-        Eigen::Matrix3d Jmp;
-        Jmp.leftCols(2)  = Rc1c0.leftCols(2) * D;
-        Jmp.rightCols(1) = Rc1c0 * Pc0x * -D;
-        mJ_mp            = totalSqrtInfo * reduce * Jmp;
-      }
+      J.block<3, 3>(0, 0) = -Rcw;
+      J.block<3, 3>(0, 3) = Rcb * Eigen::skew(Pbx);
+      mJ_f0               = sqrtW * mSqrtInfo * reduce * J;
     }
+
     return errSq;
   }
 
-public:
-  static constexpr int SIZE = 2;
+  bool isInlier(double thresholdSq) const {
+    const Sophus::SE3d    Tcw  = mTcb * mF->Twb().inverse();
+    const Eigen::Vector3d Pcx  = Tcw * mPwx;
+    const Eigen::Vector2d cost = mSqrtInfo * (Pcx.head(2) / Pcx.z() - mZ.head(2));
+    return Pcx.z() > 0.0 && cost.squaredNorm() < thresholdSq;
+  }
 
 protected:
-  db::Frame::Ptr mF0;
-  db::Frame::Ptr mF1;
-
-  Eigen::Matrix3d mRb0c0;
-  Eigen::Vector3d mPb0c0;
-  Eigen::Matrix3d mRc1b1;
-  Eigen::Vector3d mPc1b1;
-
-  db::MapPoint::Ptr mMp;
-
+  db::Frame*      mF;
+  Sophus::SE3d    mTcb;
+  Eigen::Vector3d mPwx;
   Eigen::Vector3d mZ;  //measurement
 
-  MEstimator::Ptr mME;
-  double          mSqrtInfo;
+  MEstimator* mME;
+  double      mSqrtInfo;
 
   Eigen::Vector2d  mRes;   //cost
-  Eigen::Matrix26d mJ_f0;  //jacobian for host
-  Eigen::Matrix26d mJ_f1;  //jacobian for target
-  Eigen::Matrix23d mJ_mp;  //jacobian for mp
+  Eigen::Matrix26d mJ_f0;  //jacobian for frame
 
 public:
-  db::Frame::Ptr    getFrame0() { return mF0; }
-  db::Frame::Ptr    getFrame1() { return mF1; }
-  db::MapPoint::Ptr getMapPoint() { return mMp; }
-
   const Eigen::Vector2d&  Res() const { return mRes; }
   const Eigen::Matrix26d& J_f0() const { return mJ_f0; }
-  const Eigen::Matrix26d& J_f1() const { return mJ_f1; }
-  const Eigen::Matrix23d& J_mp() const { return mJ_mp; }
 };
 
-class StereoReprojectionCost : public ReprojectionCost {
+/**
+ * @brief host camera to target camera transform shared by every reprojection cost of a
+ * host frame / target frame / target camera triple. update() once per linearization.
+ */
+class RelativePose {
 public:
-  StereoReprojectionCost() = delete;
-  StereoReprojectionCost(db::Frame::Ptr         fs0,
-                         Sophus::SE3d&          Tbc0,
-                         db::Frame::Ptr         fs1,
-                         Sophus::SE3d&          Tbc1,
-                         db::MapPoint::Ptr      mp,
-                         const Eigen::Vector3d& maesurement,
-                         MEstimator::Ptr        ME,
-                         double                 sqrtInfo = 640.0)
-    : ReprojectionCost(fs0, Tbc0, fs1, Tbc1, mp, maesurement, ME, sqrtInfo) {}
-
-  double linearlize(bool updateState) override {
-    const double&         invD   = mMp->invDepth();
-    const double          D      = 1.0 / invD;
-    const auto&           undist = mMp->undist();
-    const Eigen::Vector3d undist3d(undist.x(), undist.y(), 1.0);
-
-    Eigen::Vector3d Pc0x = undist3d * D;
-
-    Eigen::Matrix3d Rc1c0 = mRc1b1 * mRb0c0;
-    Eigen::Vector3d Pc1c0 = mRc1b1 * mPb0c0 + mPc1b1;
-
-    Eigen::Vector3d Pc1x = Rc1c0 * Pc0x + Pc1c0;
-
-    double z  = Pc1x.z();
-    double iz = 1.0 / z;
+  //index is the slot in the owner's pool, used to group costs
+  explicit RelativePose(size_t index = 0)
+    : mIndex{index} {}
 
-    Eigen::Vector3d nPc1x = Pc1x * iz;
-    Eigen::Vector2d cost  = mSqrtInfo * (nPc1x - mZ).head(2);
+  void reset(db::Frame*          fs0,
+             const Sophus::SE3d& Tb0c0,
+             db::Frame*          fs1,
+             const Sophus::SE3d& Tb1c1) {
+    mF0 = fs0;
+    mF1 = fs1;
 
-    double cSq    = cost.squaredNorm();
-    double errSq  = cSq;
-    double weight = 1.0;
+    mRb0c0 = Tb0c0.rotationMatrix();
+    mPb0c0 = Tb0c0.translation();
 
-    if (mME) {
-      std::tie(errSq, weight) = mME->computeError(cSq);
-    }
+    auto Tc1b1 = Tb1c1.inverse();
+    mRc1b1     = Tc1b1.rotationMatrix();
+    mPc1b1     = Tc1b1.translation();
+  }
 
-    if (updateState) {
-      double sqrtW = std::sqrt(weight);
+  void update() {
+    const Sophus::SE3d& Twb0 = mF0->Twb();
+    const Sophus::SE3d  Tb1w = mF1->Twb().inverse();
 
-      mRes = sqrtW * cost;
+    const Eigen::Matrix3d Rwb0 = Twb0.rotationMatrix();
+    const Eigen::Matrix3d Rb1w = Tb1w.rotationMatrix();
 
-      mJ_f0.setZero();
-      mJ_f1.setZero();
+    const Eigen::Matrix3d Rb1b0 = Rb1w * Rwb0;
+    const Eigen::Vector3d Pb1b0 = Rb1w * Twb0.translation() + Tb1w.translation();
 
-      if (mMp->fixed()) {
-        mJ_mp.setZero();
-      }
-      else {
-        double           izSq = iz * iz;
-        Eigen::Matrix23d reduce;
-        reduce << iz, 0.0, -Pc1x.x() * izSq, 0.0, iz, -Pc1x.y() * izSq;
-
-        Eigen::Matrix3d Jmp;
-        Jmp.leftCols(2)  = Rc1c0.leftCols(2) * D;
-        Jmp.rightCols(1) = Rc1c0 * Pc0x * -D;
-        mJ_mp            = sqrtW * mSqrtInfo * reduce * Jmp;
-      }
-    }
-    return errSq;
+    mRc1w  = mRc1b1 * Rb1w;
+    mRc1b0 = mRc1w * Rwb0;
+    mRb1c0 = Rb1b0 * mRb0c0;
+    mPb1c0 = Rb1b0 * mPb0c0 + Pb1b0;
+    mRc1c0 = mRc1b1 * mRb1c0;
+    mPc1c0 = mRc1b1 * mPb1c0 + mPc1b1;
   }
 
 protected:
-};
-
-class ReprojectionPriorCost : public ReprojectionCost {
-public:
-  ReprojectionPriorCost() = delete;
-  ReprojectionPriorCost(db::Frame::Ptr         fs0,
-                        Sophus::SE3d&          Tbc0,
-                        db::Frame::Ptr         fs1,
-                        Sophus::SE3d&          Tbc1,
-                        db::MapPoint::Ptr      mp,
-                        const Eigen::Vector3d& maesurement,
-                        MEstimator::Ptr        ME,
-                        double                 sqrtInfo = 640.0)
-    : ReprojectionCost(fs0, Tbc0, fs1, Tbc1, mp, maesurement, ME, sqrtInfo) {}
-
-  double linearlize(bool updateState) override {
-    Eigen::Vector2d cost = mSqrtInfo * (mMp->undist() - mZ.head(2));
-
-    double cSq    = cost.squaredNorm();
-    double errSq  = cSq;
-    double weight = 1.0;
+  size_t     mIndex;
+  db::Frame* mF0 = nullptr;
+  db::Frame* mF1 = nullptr;
 
-    if (mME) {
-      std::tie(errSq, weight) = mME->computeError(cSq);
-    }
-
-    if (updateState) {
-      double sqrtW = std::sqrt(weight);
-
-      mRes = sqrtW * cost;
+  Eigen::Matrix3d mRb0c0;
+  Eigen::Vector3d mPb0c0;
+  Eigen::Matrix3d mRc1b1;
+  Eigen::Vector3d mPc1b1;
 
-      mJ_f0.setZero();
-      mJ_f1.setZero();
+  //refreshed by update
+  Eigen::Matrix3d mRc1w;
+  Eigen::Matrix3d mRc1b0;
+  Eigen::Matrix3d mRb1c0;
+  Eigen::Vector3d mPb1c0;
+  Eigen::Matrix3d mRc1c0;
+  Eigen::Vector3d mPc1c0;
 
-      if (mMp->fixed()) {
-        mJ_mp.setZero();
-      }
-      else {
-        mJ_mp = sqrtW * mSqrtInfo * Eigen::Matrix23d::Identity();
-      }
-    }
-    return errSq;
-  }
+public:
+  size_t     index() const { return mIndex; }
+  db::Frame* frame0() const { return mF0; }
+  db::Frame* frame1() const { return mF1; }
+
+  const Eigen::Matrix3d& Rb0c0() const { return mRb0c0; }
+  const Eigen::Vector3d& Pb0c0() const { return mPb0c0; }
+  const Eigen::Matrix3d& Rc1b1() const { return mRc1b1; }
+  const Eigen::Matrix3d& Rc1w() const { return mRc1w; }
+  const Eigen::Matrix3d& Rc1b0() const { return mRc1b0; }
+  const Eigen::Matrix3d& Rb1c0() const { return mRb1c0; }
+  const Eigen::Vector3d& Pb1c0() const { return mPb1c0; }
+  const Eigen::Matrix3d& Rc1c0() const { return mRc1c0; }
+  const Eigen::Vector3d& Pc1c0() const { return mPc1c0; }
 };
 
 }  //namespace toy
\ No newline at end of file
@@ -1,120 +1,385 @@
 #include "config.h"
 #include "ToyAssert.h"
 #include "CostFunction.h"
+#include "ReprojectionBatch.h"
+#include "BlockHessian.h"
 #include "DebugUtil.h"
 #include "MapPointLinearization.h"
 
 namespace toy {
 namespace {
-static constexpr auto COST_SIZE = ReprojectionCost::SIZE;
+static constexpr auto COST_SIZE = ReprojectionBatch<double>::SIZE;
 static constexpr auto POSE_SIZE = db::Frame::PARAMETER_SIZE;
 static constexpr auto MP_SIZE   = db::MapPoint::PARAMETER_SIZE;
+
+//grow with some slack so a point gaining observations does not reallocate every frame
+template <typename Vector>
+void reserveBuffer(Vector& buffer, Eigen::Index size) {
+  if (buffer.size() < size) {
+    buffer.resize(size << 1);
+  }
+}
 }  //namespace
-MapPointLinearization::MapPointLinearization(db::MapPoint::Ptr          mp,
-                                             std::map<int64_t, size_t>* frameIdColMap,
-                                             std::vector<ReprojectionCost::Ptr>& costs)
-  : mMapPoint{mp}
-  , mFrameIdColumnMapRp{frameIdColMap} {
-  mReprojectionCosts.swap(costs);
+template <typename Scalar>
+MapPointLinearization<Scalar>::MapPointLinearization(FrameColumnMap* frameIdColMap,
+                                                     ReprojectionBatch<Scalar>* batch)
+  : mFrameIdColumnMapRp{frameIdColMap}
+  , mBatchRp{batch}
+  , mJ{nullptr, 0, 0}
+  , mRes{nullptr, 0}
+  , mRows{0}
+  , mCols{0}
+  , mLinearizedId{-1}
+  , mFactorValid{false}
+  , mReuseFactor{false} {}
 
-  int cols = mFrameIdColumnMapRp->size() * db::Frame::PARAMETER_SIZE;
-  cols += db::MapPoint::PARAMETER_SIZE;
+template <typename Scalar>
+MapPointLinearization<Scalar>::MapPointLinearization(MapPointLinearization&& src) noexcept
+  : mMapPoint{std::move(src.mMapPoint)}
+  , mFrameIdColumnMapRp{src.mFrameIdColumnMapRp}
+  , mBatchRp{src.mBatchRp}
+  , mJBuffer{std::move(src.mJBuffer)}
+  , mResBuffer{std::move(src.mResBuffer)}
+  , mQRBuffer{std::move(src.mQRBuffer)}
+  , mHouseholderBuffer{std::move(src.mHouseholderBuffer)}
+  , mJ{nullptr, 0, 0}
+  , mRes{nullptr, 0}
+  , mRows{src.mRows}
+  , mCols{src.mCols}
+  , mLinearizedMp{src.mLinearizedMp}
+  , mLinearizedId{src.mLinearizedId}
+  , mTaus{src.mTaus}
+  , mFactorValid{src.mFactorValid}
+  , mReuseFactor{src.mReuseFactor} {
+  mObservations.swap(src.mObservations);
+  mFrameColumns.swap(src.mFrameColumns);
+  mCostBlocks.swap(src.mCostBlocks);
+  mBlockFrames.swap(src.mBlockFrames);
+  mObservedFrameIds.swap(src.mObservedFrameIds);
+  mLinearizedTwbs.swap(src.mLinearizedTwbs);
+  mLinearizedFrameIds.swap(src.mLinearizedFrameIds);
+  bindStorage();
+}
 
-  auto costSize = mReprojectionCosts.size();
-  mRows         = costSize << 1;  //uv
-  mCols         = cols;
+template <typename Scalar>
+void MapPointLinearization<Scalar>::reset(db::MapPoint::Ptr mp) {
+  release();
+  mMapPoint = mp;
 
-  mJ.resize(mRows, mCols);
-  mJ.setZero();
+  //spare storage handed to another point
+  if (!mp || mp->id() != mLinearizedId) {
+    mFactorValid = false;
+  }
+}
 
-  mRes.resize(mRows);
-  mRes.setZero();
+template <typename Scalar>
+void MapPointLinearization<Scalar>::release() {
+  mMapPoint.reset();
+  mObservations.clear();
+  mFrameColumns.clear();
+  mCostBlocks.clear();
+  mBlockFrames.clear();
+  mObservedFrameIds.clear();
 }
 
-MapPointLinearization::MapPointLinearization(MapPointLinearization&& src) noexcept {
-  mReprojectionCosts.swap(src.mReprojectionCosts);
+template <typename Scalar>
+void MapPointLinearization<Scalar>::addCost(const RelativePose*    pose,
+                                            const Eigen::Vector3d& undist,
+                                            double                 sqrtInfo) {
+  mObservations.push_back(mBatchRp->add(pose, mMapPoint.get(), undist, sqrtInfo));
 }
 
-double MapPointLinearization::linearize(bool updateJacobian) {
-  mJ.setZero();
-  mRes.setZero();
+template <typename Scalar>
+void MapPointLinearization<Scalar>::setup() {
+  auto localBlock = [this](db::Frame* frame) {
+    auto it = mFrameIdColumnMapRp->find(frame->id());
+    TOY_ASSERT(it != mFrameIdColumnMapRp->end());
+
+    const size_t col = it->second;
+    for (size_t i = 0; i < mFrameColumns.size(); ++i) {
+      if (mFrameColumns[i] == col) {
+        return int(i);
+      }
+    }
+    mFrameColumns.push_back(col);
+    mBlockFrames.push_back(frame);
+    return int(mFrameColumns.size() - 1);
+  };
 
-  double errSq = 0;
-  size_t row   = 0;
+  mFrameColumns.clear();
+  mCostBlocks.clear();
+  mBlockFrames.clear();
+  mObservedFrameIds.clear();
+  for (auto handle : mObservations) {
+    const RelativePose* pose   = mBatchRp->pose(handle);
+    const int           block0 = localBlock(pose->frame0());
+    const int           block1 = localBlock(pose->frame1());
+    mCostBlocks.emplace_back(block0, block1);
+    mObservedFrameIds.push_back(pose->frame0()->id());
+    mObservedFrameIds.push_back(pose->frame1()->id());
+  }
 
-  const size_t mpCol = mJ.cols() - MP_SIZE;
+  //a new or dropped observation changes the block layout
+  mFactorValid = mFactorValid && mObservedFrameIds == mLinearizedFrameIds;
 
-  //YSTODO: tbb.... tbb might be slower
-  for (auto& cost : mReprojectionCosts) {
-    errSq += cost->linearlize(updateJacobian);
+  auto costSize = mObservations.size();
+  mRows         = costSize << 1;  //uv
+  mCols         = mFrameColumns.size() * POSE_SIZE + MP_SIZE;
 
-    if (updateJacobian) {
-      const int& id0 = cost->getFrame0()->id();
-      const int& id1 = cost->getFrame1()->id();
+  reserveBuffer(mJBuffer, Eigen::Index(mRows) * mCols);
+  reserveBuffer(mResBuffer, mRows);
+  reserveBuffer(mQRBuffer, mRows + mCols);
+  reserveBuffer(mHouseholderBuffer, Eigen::Index(mRows) * MP_SIZE);
+  bindStorage();
+
+  if (!mFactorValid) {
+    mJ.setZero();
+    mRes.setZero();
+  }
+}
 
-      TOY_ASSERT(mFrameIdColumnMapRp->find(id0) != mFrameIdColumnMapRp->end());
-      TOY_ASSERT(mFrameIdColumnMapRp->find(id1) != mFrameIdColumnMapRp->end());
+template <typename Scalar>
+void MapPointLinearization<Scalar>::bindStorage() {
+  //placement new is how eigen re-seats a map
+  new (&mJ) Eigen::Map<MatrixX>(mJBuffer.data(), mRows, mCols);
+  new (&mRes) Eigen::Map<VectorX>(mResBuffer.data(), mRows);
+}
 
-      const auto& idx0 = mFrameIdColumnMapRp->at(id0);
-      const auto& idx1 = mFrameIdColumnMapRp->at(id1);
+template <typename Scalar>
+void MapPointLinearization<Scalar>::linearize() {
+  const double threshold = Config::Vio::relinearizeThreshold;
+  mReuseFactor = threshold > 0.0 && mFactorValid && !moved(threshold);
 
-      mJ.block<COST_SIZE, POSE_SIZE>(row, idx0) = cost->J_f0();
-      mJ.block<COST_SIZE, POSE_SIZE>(row, idx1) = cost->J_f1();
-      mJ.block<COST_SIZE, MP_SIZE>(row, mpCol)  = cost->J_mp();
-      mRes.segment(row, COST_SIZE)              = cost->Res();
-      row += COST_SIZE;
+  if (mReuseFactor) {
+    for (size_t i = 0; i < mObservations.size(); ++i) {
+      mBatchRp->addResidualRows(mObservations[i], mRes, i * COST_SIZE);
     }
+    return;
+  }
+
+  mJ.setZero();
+
+  const Eigen::Index mpCol = mCols - MP_SIZE;
+
+  Eigen::Index row = 0;
+  for (size_t i = 0; i < mObservations.size(); ++i) {
+    const auto& [block0, block1] = mCostBlocks[i];
+
+    //host and target share a block for observations in the other camera of the host
+    mBatchRp->addRows(
+      mObservations[i], mJ, mRes, row, block0 * POSE_SIZE, block1 * POSE_SIZE, mpCol);
+    row += COST_SIZE;
   }
-  return errSq;
 }
 
-void MapPointLinearization::decomposeWithQR() {
-  Eigen::VectorXd buffer0(mCols);
-  Eigen::VectorXd buffer1(mRows - MP_SIZE);
-  const auto      mpIdx = mCols - MP_SIZE;
+template <typename Scalar>
+void MapPointLinearization<Scalar>::decomposeWithQR() {
+  Scalar*    buffer0 = mQRBuffer.data();
+  const auto mpIdx   = mCols - MP_SIZE;
 
-  //ToyLogD("11111111111111111111111111");
-  //ToyLogD("house holder test J : {}", ToyLogger::eigenMat(mJ));
-  //ToyLogD("house holder test Res : {}", ToyLogger::eigenVec(mRes));
+  //the reflectors of the kept factor only have to be replayed on the new residual
+  if (mReuseFactor) {
+    for (size_t k = 0u; k < MP_SIZE; ++k) {
+      size_t remainingRows = mRows - k;
+
+      auto essential = mHouseholderBuffer.segment(k * mRows, remainingRows - 1);
+      mRes.segment(k, remainingRows).applyHouseholderOnTheLeft(essential, mTaus[k], buffer0);
+    }
+    return;
+  }
 
   for (size_t k = 0u; k < MP_SIZE; ++k) {
     size_t remainingRows = mRows - k;
 
-    double beta;
-    double tau;
-    mJ.col(mpIdx + k).segment(k, remainingRows).makeHouseholder(buffer1, tau, beta);
+    auto essential = mHouseholderBuffer.segment(k * mRows, remainingRows - 1);
+
+    Scalar beta;
+    Scalar tau;
+    mJ.col(mpIdx + k).segment(k, remainingRows).makeHouseholder(essential, tau, beta);
 
-    mJ.block(k, 0, remainingRows, mCols)
-      .applyHouseholderOnTheLeft(buffer1, tau, buffer0.data());
+    mJ.block(k, 0, remainingRows, mCols).applyHouseholderOnTheLeft(essential, tau, buffer0);
 
-    mRes.segment(k, remainingRows)
-      .applyHouseholderOnTheLeft(buffer1, tau, buffer0.data());
-    //ToyLogD("house holder test J : {}", ToyLogger::eigenMat(mJ));
-    //ToyLogD("house holder test Res : {}", ToyLogger::eigenVec(mRes));
-    //ToyLogD("");
+    mRes.segment(k, remainingRows).applyHouseholderOnTheLeft(essential, tau, buffer0);
+    mTaus[k] = tau;
   }
-  //ToyLogD("2222222222222222222222222222");
-  //ToyLogD("house holder test J : {}", ToyLogger::eigenMat(mJ));
-  //ToyLogD("house holder test Res : {}", ToyLogger::eigenVec(mRes));
-  //ToyLogD("");
+
+  mLinearizedTwbs.clear();
+  for (auto frame : mBlockFrames) {
+    mLinearizedTwbs.push_back(frame->Twb());
+  }
+  mLinearizedMp << mMapPoint->undist(), mMapPoint->invDepth();
+  mLinearizedId       = mMapPoint->id();
+  mLinearizedFrameIds = mObservedFrameIds;
+  mFactorValid        = true;
 }
 
-double MapPointLinearization::backSubstitue(Eigen::VectorXd& frameDelta) {
+template <typename Scalar>
+bool MapPointLinearization<Scalar>::moved(double threshold) const {
+  Eigen::Vector3d mpState;
+  mpState << mMapPoint->undist(), mMapPoint->invDepth();
+  if ((mpState - mLinearizedMp).lpNorm<Eigen::Infinity>() > threshold) {
+    return true;
+  }
+
+  for (size_t i = 0; i < mBlockFrames.size(); ++i) {
+    const Sophus::SE3d dT = mLinearizedTwbs[i].inverse() * mBlockFrames[i]->Twb();
+    if (dT.log().lpNorm<Eigen::Infinity>() > threshold) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename Scalar>
+double MapPointLinearization<Scalar>::backSubstitue(const Eigen::VectorXd& frameDelta) {
+  using VectorMp = Eigen::Matrix<Scalar, MP_SIZE, 1>;
+
   const auto mpColIdx = mCols - MP_SIZE;
 
-  const auto Q1t_C  = mRes.head(MP_SIZE);
-  const auto Q1t_Jp = mJ.topLeftCorner(MP_SIZE, mpColIdx);
-  const auto Q1t_Jl = mJ.block<MP_SIZE, MP_SIZE>(0, mpColIdx)
-                        .triangularView<Eigen::Upper>();
+  VectorMp Q1t_r = mRes.template head<MP_SIZE>();
+  for (size_t i = 0; i < mFrameColumns.size(); ++i) {
+    const auto delta = frameDelta.segment<POSE_SIZE>(mFrameColumns[i]).cast<Scalar>();
+    Q1t_r.noalias() += mJ.template block<MP_SIZE, POSE_SIZE>(0, i * POSE_SIZE) * delta;
+  }
+
+  const auto Q1t_Jl = mJ.template block<MP_SIZE, MP_SIZE>(0, mpColIdx)
+                        .template triangularView<Eigen::Upper>();
+
+  VectorMp mpDelta = -Q1t_Jl.solve(Q1t_r);
+  mMapPoint->update(Eigen::Vector3d(mpDelta.template cast<double>()));
 
-  Eigen::Vector<double, MP_SIZE> mpDelta = -Q1t_Jl.solve(Q1t_C + Q1t_Jp * frameDelta);
-  mMapPoint->update(mpDelta);
+  if (!Config::Vio::compareLinearizedDiff) {
+    return 0.0;
+  }
+
+  //L(0) - L(inc) = -(J inc)^T (res + 0.5 J inc), evaluated on the rotated rows
+  const auto rows = reducedRows();
+  auto       Jinc = mQRBuffer.head(mRows);
+
+  Jinc.template head<MP_SIZE>() = Q1t_r - mRes.template head<MP_SIZE>() + Q1t_Jl * mpDelta;
+  Jinc.tail(rows).setZero();
+  for (size_t i = 0; i < mFrameColumns.size(); ++i) {
+    const auto delta = frameDelta.segment<POSE_SIZE>(mFrameColumns[i]).cast<Scalar>();
+    Jinc.tail(rows).noalias() += mJ.block(MP_SIZE, i * POSE_SIZE, rows, POSE_SIZE) * delta;
+  }
+
+  return -double(Jinc.dot(mRes + Scalar(0.5) * Jinc));
+}
+
+template <typename Scalar>
+void MapPointLinearization<Scalar>::addToHessian(MatrixX& H, VectorX& B) const {
+  const auto rows  = reducedRows();
+  const auto J     = mJ.bottomRows(rows);
+  const auto Res   = mRes.tail(rows);
+  const auto nBlks = mFrameColumns.size();
+
+  for (size_t i = 0; i < nBlks; ++i) {
+    const auto   Ji = J.template middleCols<POSE_SIZE>(i * POSE_SIZE);
+    const size_t ci = mFrameColumns[i];
+
+    for (size_t j = i; j < nBlks; ++j) {
+      const auto   Jj = J.template middleCols<POSE_SIZE>(j * POSE_SIZE);
+      const size_t cj = mFrameColumns[j];
+
+      H.template block<POSE_SIZE, POSE_SIZE>(ci, cj).noalias() += Ji.transpose() * Jj;
+      if (i != j) {
+        H.template block<POSE_SIZE, POSE_SIZE>(cj, ci).noalias() += Jj.transpose() * Ji;
+      }
+    }
+    B.template segment<POSE_SIZE>(ci).noalias() -= Ji.transpose() * Res;
+  }
+}
+
+template <typename Scalar>
+void MapPointLinearization<Scalar>::addToHessian(BlockHessian<Scalar>& H) const {
+  const auto rows  = reducedRows();
+  const auto J     = mJ.bottomRows(rows);
+  const auto Res   = mRes.tail(rows);
+  const auto nBlks = mFrameColumns.size();
+
+  for (size_t i = 0; i < nBlks; ++i) {
+    const auto   Ji = J.template middleCols<POSE_SIZE>(i * POSE_SIZE);
+    const size_t ci = mFrameColumns[i];
 
-  if (Config::Vio::compareLinearizedDiff) {
-    TOY_ASSERT_MESSAGE(false, "not implemented");
-    return 100.0;
+    for (size_t j = i; j < nBlks; ++j) {
+      const auto Jj = J.template middleCols<POSE_SIZE>(j * POSE_SIZE);
+      H.add(ci, mFrameColumns[j], Ji.transpose() * Jj);
+    }
+    H.b().template segment<POSE_SIZE>(ci).noalias() -= Ji.transpose() * Res;
   }
+}
+
+template <typename Scalar>
+void MapPointLinearization<Scalar>::addToBlockDiagonal(MatrixX& D, VectorX& B) const {
+  const auto rows = reducedRows();
+  const auto J    = mJ.bottomRows(rows);
+  const auto Res  = mRes.tail(rows);
 
-  return 0.0;
+  for (size_t i = 0; i < mFrameColumns.size(); ++i) {
+    const auto   Ji = J.template middleCols<POSE_SIZE>(i * POSE_SIZE);
+    const size_t ci = mFrameColumns[i];
+
+    D.template middleCols<POSE_SIZE>(ci).noalias() += Ji.transpose() * Ji;
+    B.template segment<POSE_SIZE>(ci).noalias() -= Ji.transpose() * Res;
+  }
 }
+
+template <typename Scalar>
+void MapPointLinearization<Scalar>::addHessianProduct(const VectorX& x, VectorX& y) {
+  const auto rows = reducedRows();
+  const auto J    = mJ.bottomRows(rows);
+  auto       Jx   = mQRBuffer.head(rows);
+
+  Jx.setZero();
+  for (size_t i = 0; i < mFrameColumns.size(); ++i) {
+    Jx.noalias() += J.template middleCols<POSE_SIZE>(i * POSE_SIZE) *
+                    x.template segment<POSE_SIZE>(mFrameColumns[i]);
+  }
+  for (size_t i = 0; i < mFrameColumns.size(); ++i) {
+    y.template segment<POSE_SIZE>(mFrameColumns[i]).noalias() +=
+      J.template middleCols<POSE_SIZE>(i * POSE_SIZE).transpose() * Jx;
+  }
+}
+
+template <typename Scalar>
+void MapPointLinearization<Scalar>::addToQRJacobian(Eigen::MatrixXd& Q2t_J,
+                                                    Eigen::VectorXd& Q2t_C,
+                                                    size_t&          startRow) const {
+  const auto rows = reducedRows();
+
+  for (size_t i = 0; i < mFrameColumns.size(); ++i) {
+    Q2t_J.block(startRow, mFrameColumns[i], rows, POSE_SIZE) =
+      mJ.block(MP_SIZE, i * POSE_SIZE, rows, POSE_SIZE).template cast<double>();
+  }
+  Q2t_C.segment(startRow, rows) = mRes.tail(rows).template cast<double>();
+
+  startRow += rows;
+}
+
+template <typename Scalar>
+void MapPointLinearization<Scalar>::addToQRJacobian(Eigen::MatrixXd&      Q2t_J,
+                                                    Eigen::VectorXd&      Q2t_C,
+                                                    size_t&               startRow,
+                                                    const FrameColumnMap& frameIdColMap) const {
+  const auto rows = reducedRows();
+
+  for (size_t i = 0; i < mBlockFrames.size(); ++i) {
+    auto it = frameIdColMap.find(mBlockFrames[i]->id());
+    TOY_ASSERT(it != frameIdColMap.end());
+
+    Q2t_J.block(startRow, it->second, rows, POSE_SIZE) =
+      mJ.block(MP_SIZE, i * POSE_SIZE, rows, POSE_SIZE).template cast<double>();
+  }
+  Q2t_C.segment(startRow, rows) = mRes.tail(rows).template cast<double>();
+
+  startRow += rows;
+}
+
+template <typename Scalar>
+int MapPointLinearization<Scalar>::reducedRows() const {
+  return mRows - MP_SIZE;
+}
+
+template class MapPointLinearization<float>;
+template class MapPointLinearization<double>;
 }  //namespace toy
@@ -1,47 +1,137 @@
 #pragma once
 #include <memory>
 #include <vector>
-#include <map>
 #include <Eigen/Dense>
+#include "sophus/se3.hpp"
 #include "macros.h"
+#include "FlatMap.h"
 
 namespace toy {
 namespace db {
+class Frame;
 class MapPoint;
-}
-class ReprojectionCost;
-class PoseOnlyReporjectinCost;
+}  //namespace db
+class RelativePose;
+template <typename Scalar>
+class ReprojectionBatch;
+template <typename Scalar>
+class BlockHessian;
+/**
+ * @brief landmark block of the sqrt problem. only the frames observing the map point get
+ * a column block, so mJ is 2N x (6 * observed frames + 3) and mFrameColumns maps each
+ * block back to its column in the reduced camera system.
+ * residuals come from the problem's ReprojectionBatch, storage is kept across reset() so
+ * a pooled linearization does not allocate once it has seen as many observations.
+ * the block and its QR are kept in Scalar, frame deltas and landmark updates in double.
+ * a pooled linearization of the same point keeps its factored block across solves, and
+ * only refreshes the residual while the observations are unchanged and neither the
+ * frames nor the point moved past Config::Vio::relinearizeThreshold. the kept block still
+ * holds the robust weights it was built with while the residual gets new ones, so reuse
+ * stays off (threshold 0) by default.
+ */
+template <typename Scalar>
 class MapPointLinearization {
 public:
   USING_SMART_PTR(MapPointLinearization);
+  using FrameColumnMap = FlatMap<int64_t, size_t>;
+  using MatrixX        = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+  using VectorX        = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+
   MapPointLinearization() = delete;
-  MapPointLinearization(std::shared_ptr<db::MapPoint>                   mp,
-                        std::map<int64_t, size_t>*                      frameIdColMap,
-                        std::vector<std::shared_ptr<ReprojectionCost>>& costs);
+  MapPointLinearization(FrameColumnMap* frameIdColMap, ReprojectionBatch<Scalar>* batch);
   MapPointLinearization(MapPointLinearization&& src) noexcept;
 
   ~MapPointLinearization() = default;
 
-  virtual double linearize(bool updateJacobian);
-  virtual void   decomposeWithQR();
+  /** @brief start a new map point */
+  void reset(std::shared_ptr<db::MapPoint> mp);
+  void release();
+
+  void addCost(const RelativePose* pose, const Eigen::Vector3d& undist, double sqrtInfo);
+
+  /** @brief assign frame blocks and size the jacobian once all costs are added */
+  void setup();
+
+  /** @brief copy the rows of the already linearized batch into mJ and mRes */
+  virtual void linearize();
+  virtual void decomposeWithQR();
+
+  /** @brief true when the last linearize kept the factored jacobian */
+  bool reusedFactor() const { return mReuseFactor; }
+
+  /** @brief the next linearize rebuilds the jacobian whatever relinearizeThreshold says */
+  void invalidateFactor() { mFactorValid = false; }
+
+  /** @brief update the point, returns L(0) - L(inc) when compareLinearizedDiff */
+  virtual double backSubstitue(const Eigen::VectorXd& frameDelta);
+
+  /** @brief add Q2^T J and Q2^T res of the touched frame blocks into H and B */
+  void addToHessian(MatrixX& H, VectorX& B) const;
+  void addToHessian(BlockHessian<Scalar>& H) const;
+
+  /** @brief diagonal frame blocks (6 x frame columns) and B of the reduced rows */
+  void addToBlockDiagonal(MatrixX& D, VectorX& B) const;
+  /** @brief y += Jt J x over the reduced rows, never forming Jt J */
+  void addHessianProduct(const VectorX& x, VectorX& y);
 
-  virtual double backSubstitue(Eigen::VectorXd& frameDelta);
+  /** @brief scatter Q2^T J and Q2^T res into the stacked jacobian from startRow */
+  void addToQRJacobian(Eigen::MatrixXd& Q2t_J,
+                       Eigen::VectorXd& Q2t_C,
+                       size_t&          startRow) const;
+
+  /** @brief same, with the frame columns of another problem */
+  void addToQRJacobian(Eigen::MatrixXd&      Q2t_J,
+                       Eigen::VectorXd&      Q2t_C,
+                       size_t&               startRow,
+                       const FrameColumnMap& frameIdColMap) const;
+
+protected:
+  void bindStorage();
+  bool moved(double threshold) const;
 
 protected:
-  std::shared_ptr<db::MapPoint>                  mMapPoint;
-  std::vector<std::shared_ptr<ReprojectionCost>> mReprojectionCosts;
+  std::shared_ptr<db::MapPoint> mMapPoint;
+
+  FrameColumnMap*                  mFrameIdColumnMapRp;
+  ReprojectionBatch<Scalar>*       mBatchRp;
+  std::vector<size_t>              mObservations;  //handles in the batch
+  std::vector<size_t>              mFrameColumns;  //column in H of each local block
+  std::vector<std::pair<int, int>> mCostBlocks;    //local host/target block per cost
+  std::vector<db::Frame*>          mBlockFrames;   //frame of each local block
+  std::vector<int64_t>             mObservedFrameIds;
 
-  std::map<int64_t, size_t>* mFrameIdColumnMapRp;
-  Eigen::MatrixXd            mJ;
-  Eigen::VectorXd            mRes;
-  int                        mRows;
-  int                        mCols;
+  VectorX mJBuffer;
+  VectorX mResBuffer;
+  VectorX mQRBuffer;
+  VectorX mHouseholderBuffer;  //essential parts of the landmark reflectors
+
+  Eigen::Map<MatrixX> mJ;
+  Eigen::Map<VectorX> mRes;
+  int                 mRows;
+  int                 mCols;
+
+  //linearization point of the factored block
+  std::vector<Sophus::SE3d>   mLinearizedTwbs;
+  std::vector<int64_t>        mLinearizedFrameIds;
+  Eigen::Vector3d             mLinearizedMp;
+  int64_t                     mLinearizedId;
+  Eigen::Matrix<Scalar, 3, 1> mTaus;  //one reflector per landmark parameter
+  bool                        mFactorValid;
+  bool                        mReuseFactor;
 
 public:
   const std::shared_ptr<db::MapPoint>& mp() const { return mMapPoint; }
-  const Eigen::MatrixXd&               J() const { return mJ; };
-  Eigen::MatrixXd&                     getJ() { return mJ; }
+  const Eigen::Map<MatrixX>&           J() const { return mJ; };
+  Eigen::Map<MatrixX>&                 getJ() { return mJ; }
+
+  const Eigen::Map<VectorX>& Res() const { return mRes; };
+  const std::vector<size_t>& frameColumns() const { return mFrameColumns; }
+  const std::vector<size_t>& observations() const { return mObservations; }
+
+  //host and target frame id of each observation
+  const std::vector<int64_t>& observedFrameIds() const { return mObservedFrameIds; }
 
-  const Eigen::VectorXd& Res() const { return mRes; };
+  //rows left for the frames after the landmark is eliminated
+  int reducedRows() const;
 };
-}  //namespace toy
\ No newline at end of file
+}  //namespace toy
@@ -0,0 +1,382 @@
+#include <algorithm>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include "config.h"
+#include "ToyAssert.h"
+#include "CostFunction.h"
+#include "ReprojectionBatch.h"
+
+namespace toy {
+namespace {
+//rows of the SoA arrays, one column per observation
+enum InRow { UX = 0, UY, INVD, ZX, ZY, SQRT_INFO, MP_FREE, IN_SIZE };
+
+enum TmpRow {
+  T_D = 0,
+  T_X,
+  T_Y,
+  T_PX,  //point in target camera
+  T_PY,
+  T_PZ,
+  T_IZ,
+  T_QX,
+  T_QY,
+  T_KIZ,
+  T_W,
+  T_VX,  //point in host or target body
+  T_VY,
+  T_VZ,
+  T_A,  //2x3 reduce * R, row major
+  TMP_SIZE = T_A + 6
+};
+
+//jacobians are 2 x N row major
+enum OutRow {
+  RES_U = 0,
+  RES_V,
+  J_F0,
+  J_F1     = J_F0 + 12,
+  J_MP     = J_F1 + 12,
+  ERR      = J_MP + 6,
+  OUT_SIZE = ERR + 1
+};
+}  //namespace
+
+template <typename Scalar>
+ReprojectionBatch<Scalar>::ReprojectionBatch()
+  : mDirty{false}
+  , mHuberConst{0} {}
+
+template <typename Scalar>
+void ReprojectionBatch<Scalar>::reset() {
+  mPoses.clear();
+  mMapPoints.clear();
+  mMeasurements.clear();
+  mSqrtInfos.clear();
+  mDirty = true;
+}
+
+template <typename Scalar>
+void ReprojectionBatch<Scalar>::setMEstimator(MEstimator::Ptr ME) {
+  mME = ME;
+
+  auto huber  = std::dynamic_pointer_cast<Huber>(ME);
+  mHuberConst = huber ? Scalar(huber->constant()) : Scalar(0);
+}
+
+template <typename Scalar>
+size_t ReprojectionBatch<Scalar>::add(const RelativePose*    pose,
+                                      db::MapPoint*          mp,
+                                      const Eigen::Vector3d& z,
+                                      double                 sqrtInfo) {
+  mPoses.push_back(pose);
+  mMapPoints.push_back(mp);
+  mMeasurements.push_back(z);
+  mSqrtInfos.push_back(sqrtInfo);
+  mDirty = true;
+  return mPoses.size() - 1;
+}
+
+template <typename Scalar>
+void ReprojectionBatch<Scalar>::setup() {
+  const size_t size = mPoses.size();
+
+  size_t groups = 0;
+  for (auto pose : mPoses) {
+    groups = std::max(groups, pose->index() + 1);
+  }
+
+  //counting sort by relative pose
+  mGroupStarts.assign(groups + 1, 0);
+  for (auto pose : mPoses) {
+    ++mGroupStarts[pose->index() + 1];
+  }
+  for (size_t g = 0; g < groups; ++g) {
+    mGroupStarts[g + 1] += mGroupStarts[g];
+  }
+  mGroupCursor.assign(mGroupStarts.begin(), mGroupStarts.end() - 1);
+  mGroupPoses.assign(groups, nullptr);
+
+  if (size_t(mIn.cols()) < size) {
+    const auto cols = Eigen::Index(size << 1);
+    mIn.resize(IN_SIZE, cols);
+    mTmp.resize(TMP_SIZE, cols);
+    mOut.resize(OUT_SIZE, cols);
+  }
+
+  mSlots.resize(size);
+  mSlotMapPoints.resize(size);
+
+  for (size_t h = 0; h < size; ++h) {
+    const auto   group = mPoses[h]->index();
+    const size_t slot  = mGroupCursor[group]++;
+
+    mGroupPoses[group]   = mPoses[h];
+    mSlots[h]            = slot;
+    mSlotMapPoints[slot] = mMapPoints[h];
+
+    mIn(ZX, slot)        = Scalar(mMeasurements[h].x());
+    mIn(ZY, slot)        = Scalar(mMeasurements[h].y());
+    mIn(SQRT_INFO, slot) = Scalar(mSqrtInfos[h]);
+  }
+  mDirty = false;
+}
+
+template <typename Scalar>
+double ReprojectionBatch<Scalar>::linearize(bool updateJacobian) {
+  if (mDirty) {
+    setup();
+  }
+
+  const size_t groups = mGroupPoses.size();
+  if (Config::Vio::tbb) {
+    auto evaluateGroups = [&](const tbb::blocked_range<size_t>& r) {
+      for (size_t g = r.begin(); g != r.end(); ++g) {
+        evaluate(g, mGroupStarts[g], mGroupStarts[g + 1], updateJacobian);
+      }
+    };
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, groups), evaluateGroups);
+  }
+  else {
+    for (size_t g = 0; g < groups; ++g) {
+      evaluate(g, mGroupStarts[g], mGroupStarts[g + 1], updateJacobian);
+    }
+  }
+
+  return mOut.row(ERR).head(mPoses.size()).template cast<double>().sum();
+}
+
+template <typename Scalar>
+void ReprojectionBatch<Scalar>::linearize(const std::vector<size_t>& handles) {
+  if (mDirty) {
+    setup();
+  }
+
+  mSubsetSlots.clear();
+  for (auto h : handles) {
+    mSubsetSlots.push_back(mSlots[h]);
+  }
+  std::sort(mSubsetSlots.begin(), mSubsetSlots.end());
+
+  //consecutive slots of a group are one run, evaluated like a small group
+  mSubsetRuns.clear();
+  size_t group = 0;
+  for (auto slot : mSubsetSlots) {
+    while (slot >= mGroupStarts[group + 1]) {
+      ++group;
+    }
+    if (!mSubsetRuns.empty() && mSubsetRuns.back().group == group &&
+        mSubsetRuns.back().end == slot) {
+      ++mSubsetRuns.back().end;
+    }
+    else {
+      mSubsetRuns.push_back({group, slot, slot + 1});
+    }
+  }
+
+  const size_t runs = mSubsetRuns.size();
+  if (Config::Vio::tbb) {
+    auto evaluateRuns = [&](const tbb::blocked_range<size_t>& r) {
+      for (size_t i = r.begin(); i != r.end(); ++i) {
+        const auto& run = mSubsetRuns[i];
+        evaluate(run.group, run.begin, run.end, true);
+      }
+    };
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, runs), evaluateRuns);
+  }
+  else {
+    for (const auto& run : mSubsetRuns) {
+      evaluate(run.group, run.begin, run.end, true);
+    }
+  }
+}
+
+template <typename Scalar>
+void ReprojectionBatch<Scalar>::evaluate(size_t group,
+                                         size_t begin,
+                                         size_t end,
+                                         bool   updateJacobian) {
+  const size_t b = begin;
+  const size_t n = end - begin;
+  if (n == 0) {
+    return;
+  }
+  const RelativePose& pose = *mGroupPoses[group];
+
+  using Matrix3 = Eigen::Matrix<Scalar, 3, 3>;
+  using Vector3 = Eigen::Matrix<Scalar, 3, 1>;
+
+  for (size_t s = b; s < b + n; ++s) {
+    const db::MapPoint* mp     = mSlotMapPoints[s];
+    const auto&         undist = mp->undist();
+
+    mIn(UX, s)      = Scalar(undist.x());
+    mIn(UY, s)      = Scalar(undist.y());
+    mIn(INVD, s)    = Scalar(mp->invDepth());
+    mIn(MP_FREE, s) = mp->fixed() ? Scalar(0) : Scalar(1);
+  }
+
+  auto in  = [&](int k) { return mIn.row(k).segment(b, n); };
+  auto tmp = [&](int k) { return mTmp.row(k).segment(b, n); };
+  auto out = [&](int k) { return mOut.row(k).segment(b, n); };
+
+  //host camera point is (X, Y, D)
+  auto D = tmp(T_D);
+  auto X = tmp(T_X);
+  auto Y = tmp(T_Y);
+  D      = in(INVD).inverse();
+  X      = in(UX) * D;
+  Y      = in(UY) * D;
+
+  auto transform = [&](const Eigen::Matrix3d& Rd, const Eigen::Vector3d& td, int row) {
+    const Matrix3 R = Rd.cast<Scalar>();
+    const Vector3 t = td.cast<Scalar>();
+    for (int i = 0; i < 3; ++i) {
+      tmp(row + i) = R(i, 0) * X + R(i, 1) * Y + R(i, 2) * D + t(i);
+    }
+  };
+
+  transform(pose.Rc1c0(), pose.Pc1c0(), T_PX);
+  auto px = tmp(T_PX);
+  auto py = tmp(T_PY);
+  auto pz = tmp(T_PZ);
+  auto iz = tmp(T_IZ);
+  iz      = pz.inverse();
+
+  auto ru  = out(RES_U);
+  auto rv  = out(RES_V);
+  auto err = out(ERR);
+  auto w   = tmp(T_W);
+  ru       = in(SQRT_INFO) * (px * iz - in(ZX));
+  rv       = in(SQRT_INFO) * (py * iz - in(ZY));
+  err      = ru.square() + rv.square();
+
+  if (mHuberConst > Scalar(0)) {
+    const Scalar c = mHuberConst;
+    w              = (err <= c * c).select(Scalar(1), c / err.sqrt());
+    err            = Scalar(0.5) * (Scalar(2) - w) * w * err;
+  }
+  else if (mME) {
+    for (size_t s = b; s < b + n; ++s) {
+      auto [error, weight] = mME->computeError(double(mOut(ERR, s)));
+      mOut(ERR, s)         = Scalar(error);
+      mTmp(T_W, s)         = Scalar(weight);
+    }
+  }
+  else {
+    //0.5 r^2 like the estimators and the prior, the gain ratio relies on it
+    w.setOnes();
+    err *= Scalar(0.5);
+  }
+
+  if (!updateJacobian) {
+    return;
+  }
+
+  w = w.sqrt();
+  ru *= w;
+  rv *= w;
+
+  //reduce = kiz * [1 0 qx; 0 1 qy] is the weighted projection jacobian
+  auto qx  = tmp(T_QX);
+  auto qy  = tmp(T_QY);
+  auto kiz = tmp(T_KIZ);
+  qx       = -px * iz;
+  qy       = -py * iz;
+  kiz      = w * in(SQRT_INFO) * iz;
+
+  auto reduceTimes = [&](const Eigen::Matrix3d& Md,
+                         Array&                 dst,
+                         int                    row0,
+                         int                    row1,
+                         Scalar                 sign) {
+    const Matrix3 M = Md.cast<Scalar>();
+    for (int j = 0; j < 3; ++j) {
+      dst.row(row0 + j).segment(b, n) = sign * kiz * (M(0, j) + qx * M(2, j));
+      dst.row(row1 + j).segment(b, n) = sign * kiz * (M(1, j) + qy * M(2, j));
+    }
+  };
+
+  //rotation block, sign * (reduce * R) * skew(v) row by row is sign * (a x v)
+  auto crossInto = [&](int row, Scalar sign) {
+    auto vx = tmp(T_VX);
+    auto vy = tmp(T_VY);
+    auto vz = tmp(T_VZ);
+    for (int r = 0; r < 2; ++r) {
+      auto a0 = tmp(T_A + 3 * r);
+      auto a1 = tmp(T_A + 3 * r + 1);
+      auto a2 = tmp(T_A + 3 * r + 2);
+
+      out(row + 6 * r + 3) = sign * (a1 * vz - a2 * vy);
+      out(row + 6 * r + 4) = sign * (a2 * vx - a0 * vz);
+      out(row + 6 * r + 5) = sign * (a0 * vy - a1 * vx);
+    }
+  };
+
+  if (pose.frame0()->fixed()) {
+    mOut.middleRows(J_F0, 12).middleCols(b, n).setZero();
+  }
+  else {
+    reduceTimes(pose.Rc1w(), mOut, J_F0, J_F0 + 6, Scalar(1));
+    reduceTimes(pose.Rc1b0(), mTmp, T_A, T_A + 3, Scalar(1));
+    transform(pose.Rb0c0(), pose.Pb0c0(), T_VX);
+    crossInto(J_F0, Scalar(-1));
+  }
+
+  if (pose.frame1()->fixed()) {
+    mOut.middleRows(J_F1, 12).middleCols(b, n).setZero();
+  }
+  else {
+    reduceTimes(pose.Rc1w(), mOut, J_F1, J_F1 + 6, Scalar(-1));
+    reduceTimes(pose.Rc1b1(), mTmp, T_A, T_A + 3, Scalar(1));
+    transform(pose.Rb1c0(), pose.Pb1c0(), T_VX);
+    crossInto(J_F1, Scalar(1));
+  }
+
+  //d(X, Y, D) / d(ux, uy, invD) = [D e0, D e1, -D * Pc0x]
+  const Matrix3 R      = pose.Rc1c0().cast<Scalar>();
+  const Vector3 t      = pose.Pc1c0().cast<Scalar>();
+  auto          mpFree = in(MP_FREE);
+  for (int j = 0; j < 2; ++j) {
+    out(J_MP + j)     = kiz * (R(0, j) + qx * R(2, j)) * D * mpFree;
+    out(J_MP + 3 + j) = kiz * (R(1, j) + qy * R(2, j)) * D * mpFree;
+  }
+  out(J_MP + 2) = -kiz * ((px - t(0)) + qx * (pz - t(2))) * D * mpFree;
+  out(J_MP + 5) = -kiz * ((py - t(1)) + qy * (pz - t(2))) * D * mpFree;
+}
+
+template <typename Scalar>
+void ReprojectionBatch<Scalar>::addRows(size_t               handle,
+                                        Eigen::Map<MatrixX>& J,
+                                        Eigen::Map<VectorX>& res,
+                                        Eigen::Index         row,
+                                        Eigen::Index         col0,
+                                        Eigen::Index         col1,
+                                        Eigen::Index         mpCol) const {
+  const size_t s = mSlots[handle];
+
+  for (int r = 0; r < 2; ++r) {
+    res(row + r) = mOut(RES_U + r, s);
+    for (int c = 0; c < 6; ++c) {
+      J(row + r, col0 + c) += mOut(J_F0 + 6 * r + c, s);
+      J(row + r, col1 + c) += mOut(J_F1 + 6 * r + c, s);
+    }
+    for (int c = 0; c < 3; ++c) {
+      J(row + r, mpCol + c) = mOut(J_MP + 3 * r + c, s);
+    }
+  }
+}
+
+template <typename Scalar>
+void ReprojectionBatch<Scalar>::addResidualRows(size_t               handle,
+                                                Eigen::Map<VectorX>& res,
+                                                Eigen::Index         row) const {
+  const size_t s = mSlots[handle];
+
+  res(row)     = mOut(RES_U, s);
+  res(row + 1) = mOut(RES_V, s);
+}
+
+template class ReprojectionBatch<float>;
+template class ReprojectionBatch<double>;
+}  //namespace toy
@@ -0,0 +1,97 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <Eigen/Dense>
+#include "macros.h"
+
+namespace toy {
+namespace db {
+class MapPoint;
+}
+class MEstimator;
+class RelativePose;
+/**
+ * @brief every reprojection residual of a problem in SoA layout. observations are grouped
+ * by relative pose, so each group is one streaming pass over contiguous rows with the
+ * pose broadcast, which eigen vectorizes. landmark linearizations keep a handle and copy
+ * their rows out after linearize. Scalar is the precision of residuals and jacobians.
+ */
+template <typename Scalar>
+class ReprojectionBatch {
+public:
+  USING_SMART_PTR(ReprojectionBatch);
+  using Array   = Eigen::Array<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+  using MatrixX = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+  using VectorX = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+
+  //residual rows of an observation
+  static constexpr int SIZE = 2;
+
+  ReprojectionBatch();
+  ~ReprojectionBatch() = default;
+
+  void reset();
+  void setMEstimator(std::shared_ptr<MEstimator> ME);
+
+  /** @brief returns the handle of the observation */
+  size_t add(const RelativePose*    pose,
+             db::MapPoint*          mp,
+             const Eigen::Vector3d& z,
+             double                 sqrtInfo);
+
+  /** @brief error of all observations, jacobians are evaluated when updateJacobian */
+  double linearize(bool updateJacobian);
+  /** @brief residuals and jacobians of the given observations only */
+  void linearize(const std::vector<size_t>& handles);
+
+  const RelativePose* pose(size_t handle) const { return mPoses[handle]; }
+
+  /** @brief add the 2 rows of an observation into a landmark jacobian */
+  void addRows(size_t               handle,
+               Eigen::Map<MatrixX>& J,
+               Eigen::Map<VectorX>& res,
+               Eigen::Index         row,
+               Eigen::Index         col0,
+               Eigen::Index         col1,
+               Eigen::Index         mpCol) const;
+
+  /** @brief only the 2 residual rows, for a landmark keeping its factored jacobian */
+  void addResidualRows(size_t handle, Eigen::Map<VectorX>& res, Eigen::Index row) const;
+
+protected:
+  void setup();
+  /** @brief slots [begin, end) of a relative pose group */
+  void evaluate(size_t group, size_t begin, size_t end, bool updateJacobian);
+
+protected:
+  //observations in add order
+  std::vector<const RelativePose*> mPoses;
+  std::vector<db::MapPoint*>       mMapPoints;
+  std::vector<Eigen::Vector3d>     mMeasurements;
+  std::vector<double>              mSqrtInfos;
+
+  //slot of each handle, slots are sorted by relative pose
+  std::vector<size_t>              mSlots;
+  std::vector<size_t>              mGroupStarts;
+  std::vector<size_t>              mGroupCursor;
+  std::vector<const RelativePose*> mGroupPoses;
+  std::vector<db::MapPoint*>       mSlotMapPoints;
+  bool                             mDirty;
+
+  //partial linearize, sorted slots and their runs within a group
+  struct Run {
+    size_t group;
+    size_t begin;
+    size_t end;
+  };
+  std::vector<size_t> mSubsetSlots;
+  std::vector<Run>    mSubsetRuns;
+
+  Array mIn;
+  Array mTmp;
+  Array mOut;
+
+  std::shared_ptr<MEstimator> mME;
+  Scalar                      mHuberConst;  //<= 0 for non huber estimators
+};
+}  //namespace toy
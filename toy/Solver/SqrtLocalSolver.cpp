@@ -1,8 +1,11 @@
+#include <algorithm>
+#include <cmath>
 #include <numeric>
 #include <unordered_set>
 #include <tbb/parallel_reduce.h>
 #include <tbb/blocked_range.h>
 #include "ToyLogger.h"
+#include "TimeUtil.h"
 #include "config.h"
 #include "Feature.h"
 #include "ImagePyramid.h"
@@ -23,6 +26,10 @@ namespace {
 constexpr size_t MP_SIZE    = db::MapPoint::PARAMETER_SIZE;
 constexpr size_t FRAME_SIZE = db::Frame::PARAMETER_SIZE;
 
+//frame pose difference tolerated between the float and the double landmark path
+constexpr double TRANSLATION_TOLERANCE = 1e-3;  //meter
+constexpr double ROTATION_TOLERANCE    = 1e-3;  //radian
+
 MEstimator::Ptr createReprojectionMEstimator() {
   switch (Config::Vio::reprojectionME) {
   case 1: {
@@ -35,11 +42,35 @@ MEstimator::Ptr createReprojectionMEstimator() {
   }
   return nullptr;
 }
+
+//the factor of the last solve only holds while the point kept every observation
+bool sameObservations(const MapPointLinearization<double>& mpL, const db::MapPoint::Ptr& mp) {
+  const auto& ids    = mpL.observedFrameIds();
+  const auto& hostId = mp->hostFrame()->id();
+  if (ids.size() != mp->frameFactorMap().size() * 2) {
+    return false;
+  }
+
+  size_t i = 0;
+  for (auto& [frameCamId, factor] : mp->frameFactorMap()) {
+    if (ids[i] != hostId || ids[i + 1] != frameCamId.frameId) {
+      return false;
+    }
+    i += 2;
+  }
+  return true;
+}
 }  //namespace
 
-SqrtLocalSolver::SqrtLocalSolver() {
-  mProblem      = std::make_unique<SqrtProblem>();
-  mMarginalizer = std::make_unique<SqrtMarginalizer>();
+SqrtLocalSolver::SqrtLocalSolver()
+  : mFrames{nullptr}
+  , mMapPoints{nullptr}
+  , mWindowLinearized{false} {
+  mProblem        = std::make_unique<SqrtProblem<double>>();
+  mProblemF       = std::make_unique<SqrtProblem<float>>();
+  mMarginProblem  = std::make_unique<SqrtProblem<double>>();
+  mMarginalizer   = std::make_unique<SqrtMarginalizer>();
+  mReprojectionME = createReprojectionMEstimator();
 
   //const size_t& initialFrameSize = Config::Vio::solverMinimumFrames - 1;
   //const auto    cols             = FRAME_SIZE * initialFrameSize;
@@ -61,25 +92,26 @@ SqrtLocalSolver::~SqrtLocalSolver() {}
 
 bool SqrtLocalSolver::solve(const std::vector<db::Frame::Ptr>&    frames,
                             const std::vector<db::MapPoint::Ptr>& trackingMapPoints) {
+  //the budget covers building the problem as well
+  const uint64_t deadlineNs =
+    mTimeBudgetMs > 0.0 ? util::steadyNs() + uint64_t(mTimeBudgetMs * 1e6) : 0;
+
+  mSummary          = SolverSummary();
+  mWindowLinearized = false;
   if (frames.size() < Config::Vio::solverMinimumFrames) {
     mMarginalizer->setFrames({frames.front()});
     return false;
   }
 
-  std::vector<db::Frame::Ptr> reordered = mMarginalizer->frames();
-  reordered.reserve(frames.size());
-  std::set<int64_t> frameIds;
-  for (auto& f : reordered) {
-    frameIds.insert(f->id());
-  }
+  mWindowFrames.assign(mMarginalizer->frames().begin(), mMarginalizer->frames().end());
   for (auto& f : frames) {
-    if (frameIds.count(f->id()) == 0) {
-      reordered.push_back(f);
-      frameIds.insert(f->id());
+    auto sameId = [&f](const db::Frame::Ptr& w) { return w->id() == f->id(); };
+    if (std::none_of(mWindowFrames.begin(), mWindowFrames.end(), sameId)) {
+      mWindowFrames.push_back(f);
     }
   }
 
-  mFrames    = &reordered;
+  mFrames    = &mWindowFrames;
   mMapPoints = &trackingMapPoints;
 
   for (auto& f : *mFrames) {
@@ -89,49 +121,119 @@ bool SqrtLocalSolver::solve(const std::vector<db::Frame::Ptr>&    frames,
   }
 
   /*problem->mOption.mLambda;*/
-  mProblem->reset();
-  mProblem->setFrames(mFrames);
-  mProblem->setMapPoints(mMapPoints);
+  bool result = false;
+  if (Config::Vio::solverPrecision == "float") {
+    if (Config::Vio::debug) {
+      saveWindowState(mInitialState);
+    }
+
+    setupProblem(*mProblemF);
+    mProblemF->mOption.mDeadlineNs = deadlineNs;
+    result                         = mProblemF->solve();
+    mSummary                       = mProblemF->summary();
+
+    if (Config::Vio::debug) {
+      checkPrecision();
+    }
+  }
+  else {
+    setupProblem(*mProblem);
+    mProblem->mOption.mDeadlineNs = deadlineNs;
+    result                        = mProblem->solve();
+    mSummary                      = mProblem->summary();
+    mWindowLinearized             = true;
+  }
+
+  return result;
+}
+
+template <typename Scalar>
+void SqrtLocalSolver::setupProblem(SqrtProblem<Scalar>& problem) {
+  problem.reset();
+  problem.setReprojectionMEstimator(mReprojectionME);
+  problem.setFrames(mFrames);
+  problem.setMapPoints(mMapPoints);
 
   //reprojection cost
-  MEstimator::Ptr reProjME       = createReprojectionMEstimator();
-  const double&   stdFocalLength = Config::Vio::standardFocalLength;
+  const double& stdFocalLength = Config::Vio::standardFocalLength;
 
   for (auto& mp : *mMapPoints) {
     auto& frameFactors = mp->frameFactorMap();
-
-    std::vector<ReprojectionCost::Ptr> costs;
-    costs.reserve(frameFactors.size());
-
-    db::Frame::Ptr frame0 = mp->hostFrame();
-    Sophus::SE3d&  Tbc0   = frame0->getTbc(0);
+    auto& mpL          = problem.addMapPointLinearization(mp);
+    auto  frame0       = mp->hostFrame();
 
     for (auto& [frameCamId, factor] : frameFactors) {
-      db::Frame::Ptr frame1 = factor.frame();
-      auto&          camId  = frameCamId.camId;
-      Sophus::SE3d&  Tbc1   = frame1->getTbc(camId);
-      auto&          undist = factor.undist();
-
-      ReprojectionCost::Ptr cost = std::make_shared<ReprojectionCost>(frame0,
-                                                                      Tbc0,
-                                                                      frame1,
-                                                                      Tbc1,
-                                                                      mp,
-                                                                      undist,
-                                                                      reProjME,
-                                                                      stdFocalLength);
-      costs.push_back(cost);
+      auto pose = problem.relativePose(frame0, factor.frame(), frameCamId.camId);
+      mpL.addCost(pose, factor.undist(), stdFocalLength);
     }
+    mpL.setup();
+  }
 
-    mProblem->addReprojectionCost(mp, costs);
+  problem.addMarginalizationCost(mMarginalizer->marginCost());
+}
+
+void SqrtLocalSolver::checkPrecision() {
+  //a solve cut by the budget is not comparable
+  if (mSummary.stoppedOnBudget) {
+    return;
   }
 
-  auto marginCost = mMarginalizer->createMarginCost();
-  mProblem->addMarginalizationCost(marginCost);
+  saveWindowState(mFloatState);
+  restoreWindowState(mInitialState);
 
-  auto result = mProblem->solve();
+  setupProblem(*mProblem);
+  mProblem->mOption.mDeadlineNs = 0;
+  mProblem->solve();
 
-  return result;
+  double maxTranslation = 0.0;
+  double maxRotation    = 0.0;
+  for (size_t i = 0; i < mFrames->size(); ++i) {
+    auto diff      = mFloatState.Twbs[i].inverse() * (*mFrames)[i]->getTwb();
+    maxTranslation = std::max(maxTranslation, diff.translation().norm());
+    maxRotation    = std::max(maxRotation, diff.so3().log().norm());
+  }
+
+  if (maxTranslation > TRANSLATION_TOLERANCE || maxRotation > ROTATION_TOLERANCE) {
+    ToyLogE("float solve differs from double by {} m, {} rad. double result is kept",
+            maxTranslation,
+            maxRotation);
+    mSummary          = mProblem->summary();
+    mWindowLinearized = true;
+    return;
+  }
+
+  restoreWindowState(mFloatState);
+}
+
+void SqrtLocalSolver::saveWindowState(WindowState& state) {
+  const auto& frames    = *mFrames;
+  const auto& mapPoints = *mMapPoints;
+
+  state.Twbs.resize(frames.size());
+  state.deltas.resize(Eigen::NoChange, frames.size());
+  for (size_t i = 0; i < frames.size(); ++i) {
+    state.Twbs[i]       = frames[i]->getTwb();
+    state.deltas.col(i) = frames[i]->getDelta();
+  }
+
+  state.mapPoints.resize(Eigen::NoChange, mapPoints.size());
+  for (size_t i = 0; i < mapPoints.size(); ++i) {
+    state.mapPoints.col(i) << mapPoints[i]->getUndist(), mapPoints[i]->getInvDepth();
+  }
+}
+
+void SqrtLocalSolver::restoreWindowState(const WindowState& state) {
+  const auto& frames    = *mFrames;
+  const auto& mapPoints = *mMapPoints;
+
+  for (size_t i = 0; i < frames.size(); ++i) {
+    frames[i]->setTwb(state.Twbs[i]);
+    frames[i]->setDelta(state.deltas.col(i));
+  }
+  for (size_t i = 0; i < mapPoints.size(); ++i) {
+    mapPoints[i]->getUndist()   = state.mapPoints.col(i).head<2>();
+    mapPoints[i]->getInvDepth() = state.mapPoints(2, i);
+  }
 }
 
 void SqrtLocalSolver::marginalize(std::set<int64_t>& marginalkeyFrameIds,
@@ -166,120 +268,88 @@ void SqrtLocalSolver::marginalize(std::set<int64_t>& marginalkeyFrameIds,
     auto& factorMap = mp->frameFactorMap();
     for (auto& [frameCamId, factor] : factorMap) {
       if (frameIds.count(frameCamId.frameId) == 0) {
-        frames.push_back(factor.frame());
+        frames.push_back(factor.frame()->shared_from_this());
         frameIds.insert(frameCamId.frameId);
       }
     }
   }
 
-  SqrtProblem problem;
-  problem.setFrames(&frames);
-  problem.setMapPoints(&marginalMapPoints);
+  //points still in the window reuse the factor of the last solve, relinearized at the
+  //solved state. the rest, e.g. points seen by removed frames, are linearized here
+  std::vector<std::shared_ptr<MapPointLinearization<double>>> reused;
+  std::vector<db::MapPoint::Ptr>                              freshMapPoints;
+  freshMapPoints.reserve(marginalMapPoints.size());
+
+  if (mWindowLinearized) {
+    auto windowLinearizations = mProblem->grepMarginMapPointLinearizations(marginalMapPoints);
+    for (size_t i = 0; i < marginalMapPoints.size(); ++i) {
+      auto& mpL = windowLinearizations[i];
+      if (mpL && sameObservations(*mpL, marginalMapPoints[i])) {
+        reused.push_back(mpL);
+      }
+      else {
+        freshMapPoints.push_back(marginalMapPoints[i]);
+      }
+    }
+    if (!reused.empty()) {
+      mProblem->relinearize(reused);
+    }
+  }
+  else {
+    freshMapPoints = marginalMapPoints;
+  }
 
-  MEstimator::Ptr reProjME       = createReprojectionMEstimator();
-  const double&   stdFocalLength = Config::Vio::standardFocalLength;
-  for (auto& mp : marginalMapPoints) {
-    auto&                              factorMap = mp->frameFactorMap();
-    std::vector<ReprojectionCost::Ptr> costs;
-    costs.reserve(factorMap.size());
+  //marginalization prior is always built in double, storage is kept across calls
+  auto& problem = *mMarginProblem;
+  problem.reset();
+  problem.setReprojectionMEstimator(mReprojectionME);
+  problem.setFrames(&frames);
+  problem.setMapPoints(&freshMapPoints);
 
-    db::Frame::Ptr frame0 = mp->hostFrame();
-    Sophus::SE3d&  Tbc0   = frame0->getTbc(0);
+  const double& stdFocalLength = Config::Vio::standardFocalLength;
+  for (auto& mp : freshMapPoints) {
+    auto& factorMap = mp->frameFactorMap();
+    auto& mpL       = problem.addMapPointLinearization(mp);
+    auto  frame0    = mp->hostFrame();
 
     for (auto& [frameCamId, factor] : factorMap) {
-      db::Frame::Ptr frame1 = factor.frame();
-      auto&          camId  = factor.camIdx();
-      Sophus::SE3d&  Tbc1   = frame1->getTbc(camId);
-      auto&          undist = factor.undist();
-
-      ReprojectionCost::Ptr cost = std::make_shared<ReprojectionCost>(frame0,
-                                                                      Tbc0,
-                                                                      frame1,
-                                                                      Tbc1,
-                                                                      mp,
-                                                                      undist,
-                                                                      reProjME,
-                                                                      stdFocalLength);
-      costs.push_back(cost);
+      auto pose = problem.relativePose(frame0, factor.frame(), factor.camIdx());
+      mpL.addCost(pose, factor.undist(), stdFocalLength);
     }
-    problem.addReprojectionCost(mp, costs);
+    mpL.setup();
   }
 
   problem.linearize(true);
   problem.decomposeLinearization();
 
-  auto marginCost = mMarginalizer->createMarginCost();
-  problem.addMarginalizationCost(marginCost);
-
-  Eigen::MatrixXd Q2t_J;
-  Eigen::VectorXd Q2t_C;
-  problem.getQRJacobian(Q2t_J, Q2t_C);
-  /*
-  size_t     rows = 0u;
-  const auto cols = frames.size() * db::Frame::PARAMETER_SIZE;
-
-  auto mpLinearizations = problem.mapPointLinearizations();
+  problem.addMarginalizationCost(mMarginalizer->marginCost());
 
-  for (auto& linearization : mpLinearizations) {
-    rows += (linearization->J().rows() - MP_SIZE);
-  }
-  // imu factor
-
-  // marginal factor
-  rows += mMarginalizer->J().rows();
-
-  Eigen::MatrixXd Q2t_J;
-  Eigen::VectorXd Q2t_C;
-
-  Q2t_J.resize(rows, cols);
-  Q2t_C.resize(rows);
-  Q2t_J.setZero();
-  Q2t_C.setZero();
-
-  size_t currRow = 0;
-  for (auto& linearization : mpLinearizations) {
-    auto blockRow = linearization->J().rows() - MP_SIZE;
-    // clang-format off
-    auto& Q2t_J_block =
-    Q2t_J.block(currRow, 0, blockRow, cols)
-      = linearization->J().bottomLeftCorner(blockRow, cols);
-    Q2t_C.segment(currRow, blockRow) = linearization->Res().tail(blockRow);
-    // clang-format on
-    currRow += blockRow;
+  size_t reusedRows = 0;
+  for (auto& mpL : reused) {
+    reusedRows += mpL->reducedRows();
   }
 
-  {
-    auto& J   = mMarginalizer->getJ();
-    auto& Res = mMarginalizer->getRes();
+  problem.getQRJacobian(mQ2tJ, mQ2tC, reusedRows);
 
-    Q2t_J.block(currRow, 0, J.rows(), J.cols()) = J;
-    Q2t_C.segment(currRow, J.rows())            = Res;
-    currRow += J.rows();
+  auto&  frameColumnMap = problem.getFrameIdColumnMap();
+  size_t row            = mQ2tJ.rows() - reusedRows;
+  for (auto& mpL : reused) {
+    mpL->addToQRJacobian(mQ2tJ, mQ2tC, row, frameColumnMap);
   }
-  */
-
-  std::map<int64_t, size_t>& frameColumnMap = problem.getFrameIdColumnMap();
-
-  std::set<int> marginIndces;
-  std::set<int> keepIndices;
 
+  std::vector<int> marginBlocks;
+  std::vector<int> keepBlocks;
   for (auto& f : frames) {
-    const auto& id    = f->id();
-    auto        start = frameColumnMap[id];
-    if (marginalkeyFrameIds.count(id)) {
-      for (int i = 0; i < db::Frame::PARAMETER_SIZE; ++i) {
-        marginIndces.emplace(start + i);
-      }
+    const int block = frameColumnMap[f->id()] / FRAME_SIZE;
+    if (marginalkeyFrameIds.count(f->id())) {
+      marginBlocks.push_back(block);
     }
     else {
-      for (int i = 0; i < db::Frame::PARAMETER_SIZE; ++i) {
-        keepIndices.emplace(start + i);
-      }
+      keepBlocks.push_back(block);
     }
   }
 
-  auto            cols = Q2t_J.cols();
-  Eigen::VectorXd delta(cols - marginIndces.size());
+  Eigen::VectorXd delta(keepBlocks.size() * FRAME_SIZE);
   Eigen::Index    deltaIdx = 0u;
 
   std::vector<db::Frame::Ptr> remainFrames;
@@ -296,8 +366,11 @@ void SqrtLocalSolver::marginalize(std::set<int64_t>& marginalkeyFrameIds,
     delta.segment(deltaIdx, FRAME_SIZE) = f->getDelta();
     deltaIdx += db::Frame::PARAMETER_SIZE;
   }
-  mMarginalizer->marginalize(marginIndces, keepIndices, Q2t_J, Q2t_C, delta);
+  mMarginalizer->marginalize(marginBlocks, keepBlocks, mQ2tJ, mQ2tC, delta);
   mMarginalizer->setFrames(remainFrames);
+
+  //drop the references to marginalized points and the local frame list
+  problem.reset();
 }
 
 }  //namespace toy
\ No newline at end of file
@@ -6,7 +6,9 @@
 namespace toy {
 class SqrtMarginalizer;
 class SqrtMarginalizationCost;
+template <typename Scalar>
 class SqrtProblem;
+class MEstimator;
 class SqrtLocalSolver : public VioSolver {
 public:
   SqrtLocalSolver();
@@ -21,14 +23,49 @@ public:
     std::forward_list<std::shared_ptr<db::MapPoint>>& lostMapPoints) override;
 
 protected:
+  /** @brief fill a problem with the window frames and tracking map points */
+  template <typename Scalar>
+  void setupProblem(SqrtProblem<Scalar>& problem);
+
+  /**
+   * @brief debug only, solve the window again in double from the same initial state and
+   * compare the frame poses. the double result is kept when float is off by the tolerance
+   */
+  void checkPrecision();
+
+  //frame poses, frame deltas and map point parameters of the window
+  struct WindowState {
+    std::vector<Sophus::SE3d>                Twbs;
+    Eigen::Matrix<double, 6, Eigen::Dynamic> deltas;
+    Eigen::Matrix3Xd                         mapPoints;
+  };
+  void saveWindowState(WindowState& state);
+  void restoreWindowState(const WindowState& state);
 
 protected:
-  std::unique_ptr<SqrtProblem>      mProblem;
-  std::unique_ptr<SqrtMarginalizer> mMarginalizer;
+  std::unique_ptr<SqrtProblem<double>> mProblem;
+  std::unique_ptr<SqrtProblem<float>>  mProblemF;
+  std::unique_ptr<SqrtProblem<double>> mMarginProblem;
+  std::unique_ptr<SqrtMarginalizer>    mMarginalizer;
+
+  //stacked jacobian handed to the marginalizer
+  Eigen::MatrixXd mQ2tJ;
+  Eigen::VectorXd mQ2tC;
+
+  //window frames of the current solve, marginalizer frames first
+  std::vector<std::shared_ptr<db::Frame>> mWindowFrames;
+  std::shared_ptr<MEstimator>             mReprojectionME;
 
   const std::vector<std::shared_ptr<db::Frame>>*    mFrames;
   const std::vector<std::shared_ptr<db::MapPoint>>* mMapPoints;
 
+  WindowState mInitialState;
+  WindowState mFloatState;
+
+  //mProblem holds the linearization of the last solve, marginalize reuses it.
+  //float solves leave it false, their points are linearized again on marginalization
+  bool mWindowLinearized;
+
   //std::map<int, FrameParameter>    mFrameParameterMap;
   //std::map<int, MapPointParameter> mMapPointParameterMap;
 };
@@ -11,90 +11,79 @@ class SqrtMarginalizationCost {
 public:
   USING_SMART_PTR(SqrtMarginalizationCost);
 
+  /**
+   * @brief prior of the marginalizer, J and Res are referenced not copied.
+   * one object lives as long as the marginalizer, the vectors below are its workspace.
+   */
   SqrtMarginalizationCost() = delete;
   SqrtMarginalizationCost(const std::vector<db::Frame::Ptr>& frames,
                           const Eigen::MatrixXd&             J,
                           const Eigen::VectorXd&             Res)
-    : mFrames{frames}  
+    : mFrames{frames}
     , mJ{J}
-    , mRes{Res} {
-    //mCurrentParameters.resize(rows);
-    //mInitialParameters.resize(rows);
-
-    //need one more jacobian for fixed frame
-
-    //updateParameters();
-    //mInitialParameters = mCurrentParameters;
-  }
+    , mRes{Res} {}
 
   ~SqrtMarginalizationCost() = default;
 
   double linearize() {
-    //updateParameters();
-    //auto rows = mFrames.size() * db::Frame::PARAMETER_SIZE;
-
-    Eigen::VectorXd delta = getDelta();
-    //Eigen::VectorXd delta = (mCurrentParameters - mInitialParameters).head(rows);
-    return delta.transpose() * mJ.transpose() * (0.5 * mJ * delta + mRes);
+    updateResidual();
+    return mJDelta.dot(0.5 * mJDelta + mRes);
   }
 
   void addToHessian(Eigen::MatrixXd& H, Eigen::VectorXd& B) {
-    //updateParameters();
-    auto rows = mFrames.size() * db::Frame::PARAMETER_SIZE;
-    //Eigen::VectorXd delta = (mCurrentParameters - mInitialParameters).head(rows);
-    Eigen::VectorXd delta = getDelta();
+    updateResidual();
 
     auto cols = mJ.cols();  //same as parameter rows
-    H.block(0, 0, cols, cols) += mJ.transpose() * mJ;
-    B.segment(0, cols) -= mJ.transpose() * (mJ * delta + mRes);
+    H.topLeftCorner(cols, cols).noalias() += mJ.transpose() * mJ;
+    B.head(cols).noalias() -= mJ.transpose() * mResidual;
+  }
+
+  /** @brief L(0) - L(dx) of the prior for a frame step, taken before the step is applied */
+  double linearizedDiff(const Eigen::VectorXd& frameDelta) {
+    updateResidual();
+    mJInc.noalias() = mJ * frameDelta.head(mJ.cols());
+    return -mJInc.dot(mResidual + 0.5 * mJInc);
   }
 
   void addToQRJacobian(Eigen::MatrixXd& Q2t_J, Eigen::VectorXd& Q2t_C, size_t& startRow) {
-    auto delta = getDelta();
+    updateResidual();
 
     Q2t_J.block(startRow, 0, mJ.rows(), mJ.cols()) = mJ;
-    Q2t_C.segment(startRow, mJ.rows())             = mJ * delta + mRes;
+    Q2t_C.segment(startRow, mJ.rows())             = mResidual;
 
     startRow += mJ.rows();
   }
 
 protected:
-  //void updateParameters() {
-  //  Eigen::Index row = 0;
-  //  for (auto& f : mFrames) {
-  //    mCurrentParameters.segment(row, db::Frame::PARAMETER_SIZE) = f->toParameter();
-  //    if (f->fixed()) {
-  //      mJ.block(0, row, mJ.rows(), db::Frame::PARAMETER_SIZE).setZero();
-  //    }
-  //    row += db::Frame::PARAMETER_SIZE;
-  //  }
-  //}
-
-  Eigen::VectorXd getDelta() {
-    Eigen::VectorXd out(mJ.cols());
-    Eigen::Index    row = 0;
-
+  //J * delta and J * delta + Res at the current frame deltas
+  void updateResidual() {
+    mDelta.resize(mJ.cols());
+    Eigen::Index row = 0;
     for (auto& f : mFrames) {
-      out.segment(row, db::Frame::PARAMETER_SIZE) = f->getDelta();
+      if (row >= mDelta.size()) {
+        break;
+      }
+      mDelta.segment(row, db::Frame::PARAMETER_SIZE) = f->getDelta();
       row += db::Frame::PARAMETER_SIZE;
     }
-    return out;
+
+    mJDelta.noalias() = mJ * mDelta;
+    mResidual         = mJDelta + mRes;
   }
 
 protected:
   const std::vector<db::Frame::Ptr>& mFrames;
-  //Eigen::VectorXd                    mInitialParameters;
-  //Eigen::VectorXd                    mCurrentParameters;
-
-  //const Eigen::MatrixXd& mJ_marg;
-  //const Eigen::VectorXd& mRes_marg;
+  const Eigen::MatrixXd&             mJ;
+  const Eigen::VectorXd&             mRes;
 
-  Eigen::MatrixXd mJ;
-  Eigen::MatrixXd mRes;
+  Eigen::VectorXd mDelta;
+  Eigen::VectorXd mJDelta;
+  Eigen::VectorXd mResidual;
+  Eigen::VectorXd mJInc;
 
 public:
-  auto  rows() { return mJ.rows(); }
-  auto& J() { return mJ; }
-  auto& Res() { return mRes; }
+  auto        rows() const { return mJ.rows(); }
+  const auto& J() const { return mJ; }
+  const auto& Res() const { return mRes; }
 };
-}  //namespace toy
\ No newline at end of file
+}  //namespace toy
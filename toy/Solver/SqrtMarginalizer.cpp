@@ -11,56 +11,73 @@ void SqrtMarginalizer::setFrames(const std::vector<db::Frame::Ptr>& frames) {
   mFrames = frames;
 }
 
-std::shared_ptr<SqrtMarginalizationCost> SqrtMarginalizer::createMarginCost() {
-  return std::make_shared<SqrtMarginalizationCost>(mFrames, mJ, mRes);
+std::shared_ptr<SqrtMarginalizationCost> SqrtMarginalizer::marginCost() {
+  if (!mMarginCost) {
+    mMarginCost = std::make_shared<SqrtMarginalizationCost>(mFrames, mJ, mRes);
+  }
+  return mMarginCost;
 }
 
-void SqrtMarginalizer::marginalize(std::set<int>&   marginIndices,
-                                   std::set<int>&   remainIndices,
-                                   Eigen::MatrixXd& J,
-                                   Eigen::VectorXd& Res,
-                                   Eigen::VectorXd& delta) {
-  using PermutationWrapper = Eigen::PermutationWrapper<
-    Eigen::Matrix<int, Eigen::Dynamic, 1>>;
-
-  Eigen::VectorXi indices(J.cols());
-  size_t          currIndex = 0;
-  for (auto& index : marginIndices) {
-    indices[currIndex++] = index;
-  }
-  for (auto& index : remainIndices) {
-    indices[currIndex++] = index;
+void SqrtMarginalizer::marginalize(const std::vector<int>& marginBlocks,
+                                   const std::vector<int>& keepBlocks,
+                                   const Eigen::MatrixXd&  J,
+                                   const Eigen::VectorXd&  Res,
+                                   const Eigen::VectorXd&  delta) {
+  constexpr int BLOCK = db::Frame::PARAMETER_SIZE;
+
+  const Eigen::Index rows       = J.rows();
+  const Eigen::Index marginCols = marginBlocks.size() * BLOCK;
+  const Eigen::Index keepCols   = keepBlocks.size() * BLOCK;
+
+  //rows without a marginal frame skip the marginal part of the QR
+  auto touchesMargin = [&](Eigen::Index r) {
+    for (auto block : marginBlocks) {
+      if (!J.row(r).segment<BLOCK>(block * BLOCK).isZero(0.0)) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  mRowOrder.clear();
+  mRowOrder.reserve(rows);
+  mUntouchedRows.clear();
+  for (Eigen::Index r = 0; r < rows; ++r) {
+    (touchesMargin(r) ? mRowOrder : mUntouchedRows).push_back(r);
   }
-  //debug::drawSparseMatrix("before Per", J , 1);
-
-  const PermutationWrapper permutation(indices);
-  J.applyOnTheRight(permutation);
+  const size_t touchedRows = mRowOrder.size();
+  mRowOrder.insert(mRowOrder.end(), mUntouchedRows.begin(), mUntouchedRows.end());
+
+  //permute by frame blocks, marginal frames first
+  mPermutedJ.resize(rows, marginCols + keepCols);
+  Eigen::Index col        = 0;
+  auto         copyBlocks = [&](const std::vector<int>& blocks) {
+    for (auto block : blocks) {
+      mPermutedJ.middleCols<BLOCK>(col) = J(mRowOrder, Eigen::seqN(block * BLOCK, BLOCK));
+      col += BLOCK;
+    }
+  };
+  copyBlocks(marginBlocks);
+  copyBlocks(keepBlocks);
+  mPermutedRes = Res(mRowOrder);
 
   size_t margRank       = 0;
   size_t validBlockRows = 0;
-  //debug::drawSparseMatrix("before QR", J , 1);
-
-  decomposeWithQR(J, Res, marginIndices.size(), margRank, validBlockRows);
 
-  size_t& rows = validBlockRows;
-  size_t  cols = indices.rows() - marginIndices.size();
+  decomposeWithQR(mPermutedJ, mPermutedRes, marginCols, touchedRows, margRank, validBlockRows);
 
-  mJ.resize(rows, cols);
-  mRes.resize(rows);
+  size_t& keepRows = validBlockRows;
 
-  mJ   = J.block(margRank, marginIndices.size(), rows, cols);
-  mRes = Res.segment(margRank, rows) - mJ * delta;
+  mJ   = mPermutedJ.block(margRank, marginCols, keepRows, keepCols);
+  mRes = mPermutedRes.segment(margRank, keepRows) - mJ * delta;
 
   //debug::drawSparseMatrix("after QR", mJ ,1);
-
-  //ToyLogD("final QR {}", ToyLogger::eigenMat(mJ, 2));
-  //ToyLogD("final QR {}", ToyLogger::eigenVec(mRes, 2));
-  //ToyLogD("=============================================================");
 }
 
 void SqrtMarginalizer::decomposeWithQR(Eigen::MatrixXd& J,
                                        Eigen::VectorXd& Res,
                                        const size_t&    marginBlockSize,
+                                       const size_t&    touchedRows,
                                        size_t&          marginRank,
                                        size_t&          validBlockRows) {
   //to check rank deficiency
@@ -70,39 +87,45 @@ void SqrtMarginalizer::decomposeWithQR(Eigen::MatrixXd& J,
 
   double* pBuffer = vecBuffer.data();
 
-  Eigen::Index margRank  = 0;
   Eigen::Index totalRank = 0;
 
   double       beta, tau;
   const double betaThreshold = std::sqrt(std::numeric_limits<double>::epsilon());
 
-  for (Eigen::Index k = 0; k < cols && totalRank < rows; ++k) {
-    Eigen::Index remainingRows = rows - totalRank;
+  auto reduceColumn = [&](Eigen::Index k, Eigen::Index endRow) {
+    Eigen::Index remainingRows = endRow - totalRank;
     Eigen::Index remainingCols = cols - k - 1;
-    J.col(k).tail(remainingRows).makeHouseholderInPlace(tau, beta);
+    if (remainingRows <= 0) {
+      return;
+    }
+    auto column = J.col(k).segment(totalRank, remainingRows);
+    column.makeHouseholderInPlace(tau, beta);
 
     if (std::abs(beta) > betaThreshold) {
       J.coeffRef(totalRank, k) = beta;
 
-      J.bottomRightCorner(remainingRows, remainingCols)
-        .applyHouseholderOnTheLeft(J.col(k).tail(remainingRows - 1),
-                                   tau,
-                                   pBuffer + k + 1);
-      Res.tail(remainingRows)
-        .applyHouseholderOnTheLeft(J.col(k).tail(remainingRows - 1), tau, pBuffer + cols);
+      J.block(totalRank, k + 1, remainingRows, remainingCols)
+        .applyHouseholderOnTheLeft(column.tail(remainingRows - 1), tau, pBuffer + k + 1);
+      Res.segment(totalRank, remainingRows)
+        .applyHouseholderOnTheLeft(column.tail(remainingRows - 1), tau, pBuffer + cols);
       totalRank++;
     }
     else {
       J.coeffRef(totalRank, k) = 0;
     }
     //Overwrite householder vectors with 0
-    J.col(k).tail(remainingRows - 1).setZero();
+    column.tail(remainingRows - 1).setZero();
+  };
 
-    //Save the rank of marginalize-out part
-    if (k == marginBlockSize - 1) {
-      marginRank = totalRank;
-    }
+  //marginal columns are zero below the touched rows
+  for (Eigen::Index k = 0; k < Eigen::Index(marginBlockSize); ++k) {
+    reduceColumn(k, touchedRows);
+  }
+  marginRank = totalRank;
+
+  for (Eigen::Index k = marginBlockSize; k < cols && totalRank < rows; ++k) {
+    reduceColumn(k, rows);
   }
   validBlockRows = std::max(totalRank - marginRank, size_t{1});
 }
-}  //namespace toy
\ No newline at end of file
+}  //namespace toy
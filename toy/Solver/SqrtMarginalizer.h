@@ -1,7 +1,6 @@
 #pragma once
 
 #include <vector>
-#include <set>
 #include <Eigen/Dense>
 #include "macros.h"
 
@@ -17,18 +16,23 @@ public:
   ~SqrtMarginalizer() = default;
 
   void setFrames(const std::vector<std::shared_ptr<db::Frame>>& frames);
-  std::shared_ptr<SqrtMarginalizationCost> createMarginCost();
 
-  void marginalize(std::set<int>&   marginIndices,
-                   std::set<int>&   remainIndices,
-                   Eigen::MatrixXd& J,
-                   Eigen::VectorXd& Res,
-                   Eigen::VectorXd& delta);
+  /** @brief one cost for the lifetime of the marginalizer, it follows mJ and mRes */
+  std::shared_ptr<SqrtMarginalizationCost> marginCost();
+
+  /** @brief blocks are frame indices of 6 columns, in column order */
+  void marginalize(const std::vector<int>& marginBlocks,
+                   const std::vector<int>& keepBlocks,
+                   const Eigen::MatrixXd&  J,
+                   const Eigen::VectorXd&  Res,
+                   const Eigen::VectorXd&  delta);
 
 protected:
+  /** @brief marginal columns only reduce the first touchedRows rows */
   void decomposeWithQR(Eigen::MatrixXd& J,
                        Eigen::VectorXd& Res,
                        const size_t&    marginBlockSize,
+                       const size_t&    touchedRows,
                        size_t&          marginRank,
                        size_t&          validBlockRows);
 
@@ -36,8 +40,16 @@ protected:
   Eigen::MatrixXd mJ;
   Eigen::VectorXd mRes;
 
+  //block permuted system, rows touching the marginal frames first
+  Eigen::MatrixXd  mPermutedJ;
+  Eigen::VectorXd  mPermutedRes;
+  std::vector<int> mRowOrder;
+  std::vector<int> mUntouchedRows;
+
   std::vector<std::shared_ptr<db::Frame>> mFrames;
 
+  std::shared_ptr<SqrtMarginalizationCost> mMarginCost;
+
 public:
   auto&                  frames() { return mFrames; }
   const Eigen::MatrixXd& J() const { return mJ; }
@@ -1,38 +1,109 @@
-#include <tbb/parallel_reduce.h>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <type_traits>
 #include <tbb/blocked_range.h>
 #include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/enumerable_thread_specific.h>
 #include "config.h"
 #include "ToyAssert.h"
 #include "DebugUtil.h"
+#include "TimeUtil.h"
 #include "SqrtProblem.h"
 #include "MapPoint.h"
 #include "CostFunction.h"
 #include "SqrtMarginalizationCost.h"
 #include "MapPointLinearization.h"
+#include "ReprojectionBatch.h"
 namespace toy {
 namespace {
-static constexpr auto COST_SIZE = ReprojectionCost::SIZE;
+static constexpr auto COST_SIZE = ReprojectionBatch<double>::SIZE;
 static constexpr auto POSE_SIZE = db::Frame::PARAMETER_SIZE;
 static constexpr auto MP_SIZE   = db::MapPoint::PARAMETER_SIZE;
+
+LinearSolver parseLinearSolver(const std::string& name) {
+  if (name == "qr") {
+    return LinearSolver::QR;
+  }
+  if (name == "sparse") {
+    return LinearSolver::SPARSE_LDLT;
+  }
+  if (name == "pcg") {
+    return LinearSolver::PCG;
+  }
+  return LinearSolver::LDLT;
+}
+
+//fn(i) for every index, split over tbb when enabled
+template <typename Func>
+void forEachIndex(size_t size, const Func& fn) {
+  if (Config::Vio::tbb) {
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, size),
+                      [&](const tbb::blocked_range<size_t>& r) {
+                        for (size_t i = r.begin(); i != r.end(); ++i) {
+                          fn(i);
+                        }
+                      });
+  }
+  else {
+    for (size_t i = 0; i < size; ++i) {
+      fn(i);
+    }
+  }
+}
+
+//per thread workspaces outlive the call, the ones already created are only reset
+template <typename T, typename Reset>
+void resetWorkspaces(tbb::enumerable_thread_specific<T>& workspaces, const Reset& reset) {
+  for (auto& workspace : workspaces) {
+    reset(workspace);
+  }
+}
+
+//a thread joining for the first time resets its new workspace
+template <typename T, typename Reset>
+T& localWorkspace(tbb::enumerable_thread_specific<T>& workspaces, const Reset& reset) {
+  bool  exists    = false;
+  auto& workspace = workspaces.local(exists);
+  if (!exists) {
+    reset(workspace);
+  }
+  return workspace;
+}
 }  //namespace
-SqrtProblem::Option::Option()
-  : mMaxIteration{7}
+template <typename Scalar>
+SqrtProblem<Scalar>::Option::Option()
+  : mLinearSolver{parseLinearSolver(Config::Vio::linearSolver)}
+  , mMaxIteration{7}
   , mLambda{1e-4}
   , mMaxLambda{1e2}
   , mMinLambda{1e-5}
   , mMu{2.0}
-  , mMuFactor{2.0} {}
+  , mMuFactor{2.0}
+  , mDeadlineNs{0} {}
 
-SqrtProblem::SqrtProblem()
+template <typename Scalar>
+SqrtProblem<Scalar>::SqrtProblem()
   : mFrames{nullptr}
-  , mMapPoints{nullptr} {}
+  , mMapPoints{nullptr}
+  , mReprojectionBatch{std::make_unique<ReprojectionBatch<Scalar>>()}
+  , mRelativePoseSize{0} {}
 
-SqrtProblem::~SqrtProblem() {
+template <typename Scalar>
+SqrtProblem<Scalar>::~SqrtProblem() {
   reset();
 }
 
-void SqrtProblem::reset() {
-  mOption = Option();
+template <typename Scalar>
+void SqrtProblem<Scalar>::reset() {
+  //damping carries over, consecutive windows are close to each other. a solve that ended
+  //on the damping limit starts again from the default, others stay well below the limit
+  const double lambda = mOption.mLambda;
+  mOption             = Option();
+  if (lambda < mOption.mMaxLambda) {
+    mOption.mLambda = std::clamp(lambda, mOption.mMinLambda, mOption.mMaxLambda * 1e-2);
+  }
 
   mH.setZero();
   mB.setZero();
@@ -41,12 +112,30 @@ void SqrtProblem::reset() {
   mFrames    = nullptr;
   mMapPoints = nullptr;
 
+  mRelativePoseMap.clear();
+  mRelativePoseSize = 0;
+  mReprojectionBatch->reset();
+
+  //points that left the window give their storage to new ones
+  for (auto& [id, mpL] : mLinearizationPool) {
+    if (mpL) {
+      mSpareLinearizations.push_back(std::move(mpL));
+    }
+  }
+  mLinearizationPool.clear();
+
+  for (auto& mpL : mMapPointLinearizations) {
+    const auto id = mpL->mp()->id();
+    mpL->release();
+    mLinearizationPool.insert({id, std::move(mpL)});
+  }
   mMapPointLinearizations.clear();
   mPoseOnlyReprojectionCosts.clear();
   mSqrtMarginalizationCost.reset();
 }
 
-void SqrtProblem::setFrames(const std::vector<db::Frame::Ptr>* framesRp) {
+template <typename Scalar>
+void SqrtProblem<Scalar>::setFrames(const std::vector<db::Frame::Ptr>* framesRp) {
   mFrames = framesRp;
 
   int column = 0;
@@ -56,48 +145,118 @@ void SqrtProblem::setFrames(const std::vector<db::Frame::Ptr>* framesRp) {
   }
 }
 
-void SqrtProblem::setMapPoints(const std::vector<db::MapPoint::Ptr>* mapPointsRp) {
+template <typename Scalar>
+void SqrtProblem<Scalar>::setMapPoints(const std::vector<db::MapPoint::Ptr>* mapPointsRp) {
   mMapPoints = mapPointsRp;
 }
 
-void SqrtProblem::addPoseOnlyReprojectionCost(
+template <typename Scalar>
+void SqrtProblem<Scalar>::addPoseOnlyReprojectionCost(
   std::vector<PoseOnlyReporjectinCost::Ptr>& costs) {
   mPoseOnlyReprojectionCosts.swap(costs);
 }
 
-void SqrtProblem::addReprojectionCost(db::MapPoint::Ptr                   mp,
-                                      std::vector<ReprojectionCost::Ptr>& costs) {
-  mMapPointLinearizations.emplace_back(
-    std::make_shared<MapPointLinearization>(mp, &mFrameIdColumnMap, costs));
+template <typename Scalar>
+void SqrtProblem<Scalar>::setReprojectionMEstimator(MEstimator::Ptr ME) {
+  mReprojectionBatch->setMEstimator(ME);
+}
+
+template <typename Scalar>
+const RelativePose* SqrtProblem<Scalar>::relativePose(db::Frame* frame0,
+                                              db::Frame* frame1,
+                                              size_t     camId1) {
+  RelativePoseKey key{frame0->id(), frame1->id(), camId1};
+
+  auto it = mRelativePoseMap.find(key);
+  if (it != mRelativePoseMap.end()) {
+    return it->second;
+  }
+
+  if (mRelativePoseSize == mRelativePoses.size()) {
+    mRelativePoses.push_back(std::make_unique<RelativePose>(mRelativePoses.size()));
+  }
+
+  RelativePose* pose = mRelativePoses[mRelativePoseSize++].get();
+  pose->reset(frame0, frame0->getTbc(0), frame1, frame1->getTbc(camId1));
+  pose->update();
+
+  mRelativePoseMap.insert({key, pose});
+  return pose;
+}
+
+template <typename Scalar>
+MapPointLinearization<Scalar>& SqrtProblem<Scalar>::addMapPointLinearization(
+  db::MapPoint::Ptr mp) {
+  typename MapPointLinearization<Scalar>::Ptr mpL;
+
+  auto it = mLinearizationPool.find(mp->id());
+  if (it != mLinearizationPool.end() && it->second) {
+    mpL = std::move(it->second);
+  }
+  else if (!mSpareLinearizations.empty()) {
+    mpL = std::move(mSpareLinearizations.back());
+    mSpareLinearizations.pop_back();
+  }
+  else {
+    mpL = std::make_shared<MapPointLinearization<Scalar>>(&mFrameIdColumnMap,
+                                                          mReprojectionBatch.get());
+  }
+
+  mpL->reset(mp);
+  mMapPointLinearizations.push_back(mpL);
+  return *mpL;
 }
 
-void SqrtProblem::addMarginalizationCost(SqrtMarginalizationCost::Ptr cost) {
+template <typename Scalar>
+void SqrtProblem<Scalar>::addMarginalizationCost(SqrtMarginalizationCost::Ptr cost) {
   mSqrtMarginalizationCost = cost;
 }
 
-std::vector<MapPointLinearization::Ptr> SqrtProblem::grepMarginMapPointLinearizations(
-  std::vector<db::MapPoint::Ptr>& mps) {
-  if (mps.empty())
-    return {};
+template <typename Scalar>
+std::vector<std::shared_ptr<MapPointLinearization<Scalar>>>
+SqrtProblem<Scalar>::grepMarginMapPointLinearizations(std::vector<db::MapPoint::Ptr>& mps) {
+  std::vector<std::shared_ptr<MapPointLinearization<Scalar>>> outs(mps.size());
 
-  std::vector<MapPointLinearization::Ptr> outs;
-  outs.reserve(mMapPointLinearizations.size());
+  //mps follow the order the linearizations were added in, missing ones are skipped
   auto linearizationIt = mMapPointLinearizations.begin();
-
-  for (auto it = mps.begin(); it != mps.end(); ++it) {
-    for (; linearizationIt != mMapPointLinearizations.end(); ++linearizationIt) {
-      if (*it == (*linearizationIt)->mp()) {
-        outs.push_back(*linearizationIt);
-        linearizationIt++;
-        break;
-      }
+  for (size_t i = 0; i < mps.size(); ++i) {
+    auto found = std::find_if(linearizationIt,
+                              mMapPointLinearizations.end(),
+                              [&](const auto& mpL) { return mpL->mp() == mps[i]; });
+    if (found != mMapPointLinearizations.end()) {
+      outs[i]         = *found;
+      linearizationIt = std::next(found);
     }
   }
 
   return outs;
 }
 
-bool SqrtProblem::solve() {
+template <typename Scalar>
+void SqrtProblem<Scalar>::relinearize(
+  std::vector<std::shared_ptr<MapPointLinearization<Scalar>>>& mpLs) {
+  for (size_t i = 0; i < mRelativePoseSize; ++i) {
+    mRelativePoses[i]->update();
+  }
+
+  //only the rows of the reused points, the rest of the window is not marginalized
+  mRelinearizeHandles.clear();
+  for (auto& mpL : mpLs) {
+    auto& handles = mpL->observations();
+    mRelinearizeHandles.insert(mRelinearizeHandles.end(), handles.begin(), handles.end());
+  }
+  mReprojectionBatch->linearize(mRelinearizeHandles);
+
+  auto factor = [&](size_t i) {
+    mpLs[i]->invalidateFactor();
+    mpLs[i]->linearize();
+    mpLs[i]->decomposeWithQR();
+  };
+  forEachIndex(mpLs.size(), factor);
+}
+
+template <typename Scalar>
+bool SqrtProblem<Scalar>::solve() {
   const auto& frames = *mFrames;
   //const auto  iTwb0  = frames.front()->getTwb();
 
@@ -112,6 +271,12 @@ bool SqrtProblem::solve() {
   auto  mu        = mOption.mMu;
   auto& muFactor  = mOption.mMuFactor;
 
+  //large windows switch to the sparse factorization
+  auto linearSolver = mOption.mLinearSolver;
+  if (linearSolver == LinearSolver::LDLT && frames.size() >= Config::Vio::sparseSolverFrames) {
+    linearSolver = LinearSolver::SPARSE_LDLT;
+  }
+
   bool terminated = false;
   bool converged  = false;
 
@@ -122,27 +287,76 @@ bool SqrtProblem::solve() {
   int successfulIter = 0;
   int iter           = 0;
 
+  //rejected steps are restored, so stopping between trials always leaves the best state
+  uint64_t linearizeNs     = 0;
+  uint64_t trialNs         = 0;
+  auto     deadlineReached = [this](uint64_t expectedNs) {
+    return mOption.mDeadlineNs && util::steadyNs() + expectedNs > mOption.mDeadlineNs;
+  };
+
+  mSummary = SolverSummary();
+
   while (iter <= Config::Vio::maxIteration && !terminated) {
+    if (deadlineReached(linearizeNs + trialNs)) {
+      mSummary.stoppedOnBudget = true;
+      break;
+    }
+    const uint64_t linearizeStart = util::steadyNs();
+
     double currErrSq = linearize(true);
     //ToyLogD("initial err : {}", currErrSq);
+    if (iter == 0) {
+      mSummary.initialCost = currErrSq;
+    }
+    mSummary.finalCost = currErrSq;
 
     decomposeLinearization();
 
-    mH.setZero();
-    mB.setZero();
+    if (linearSolver == LinearSolver::QR) {
+      constructReducedQR();
+    }
+    else if (linearSolver == LinearSolver::SPARSE_LDLT) {
+      constructSparseFrameHessian();
+    }
+    else if (linearSolver == LinearSolver::PCG) {
+      constructPCGSystem();
+    }
+    else {
+      mH.setZero();
+      mB.setZero();
 
-    constructFrameHessian();
+      constructFrameHessian();
+    }
+    linearizeNs = util::steadyNs() - linearizeStart;
 
     while (iter <= Config::Vio::maxIteration && !terminated) {
-      bool            deltaValid = false;
-      Eigen::VectorXd frameDelta;
+      if (deadlineReached(trialNs)) {
+        mSummary.stoppedOnBudget = true;
+        terminated               = true;
+        break;
+      }
+      const uint64_t trialStart = util::steadyNs();
+
+      bool             deltaValid = false;
+      Eigen::VectorXd& frameDelta = mFrameDelta;
 
       for (int i = 0; i < 3 && !deltaValid; ++i) {
-        Eigen::VectorXd lambdaVec = (mH.diagonal() * lambda).cwiseMax(minLambda);
-        Eigen::MatrixXd H         = mH;
-        H.diagonal() += lambdaVec;
+        if (linearSolver == LinearSolver::QR) {
+          solveDampedQR(lambda, minLambda, frameDelta);
+        }
+        else if (linearSolver == LinearSolver::SPARSE_LDLT) {
+          solveDampedSparse(lambda, minLambda, frameDelta);
+        }
+        else if (linearSolver == LinearSolver::PCG) {
+          solveDampedPCG(lambda, minLambda, frameDelta);
+        }
+        else {
+          mDampedH = mH;
+          mDampedH.diagonal() += (mH.diagonal() * lambda).cwiseMax(minLambda);
 
-        frameDelta = H.ldlt().solve(mB);
+          mLDLT.compute(mDampedH);
+          frameDelta = mLDLT.solve(mB);
+        }
 
         if (!frameDelta.array().isFinite().all()) {
           lambda = mu * lambda;
@@ -159,9 +373,13 @@ bool SqrtProblem::solve() {
 
       backupParameters();
 
-      double linearizedDiff = 0.0;
-      for (auto& mpL : mMapPointLinearizations) {
-        linearizedDiff += mpL->backSubstitue(frameDelta);
+      double linearizedDiff = backSubstitue(frameDelta);
+
+      if (Config::Vio::compareLinearizedDiff) {
+        linearizedDiff += poseOnlyLinearizedDiff(frameDelta);
+        if (mSqrtMarginalizationCost) {
+          linearizedDiff += mSqrtMarginalizationCost->linearizedDiff(frameDelta);
+        }
       }
 
       int frameRow = 0;
@@ -171,24 +389,28 @@ bool SqrtProblem::solve() {
       }
 
       double newErrSq = linearize(false);
+      trialNs         = util::steadyNs() - trialStart;
 
-      bool validStep = true;
+      double errDiff   = currErrSq - newErrSq;
+      double stepRatio = errDiff;
+      bool   validStep = true;
 
+      //gain ratio of the actual against the linearized model reduction
       if (Config::Vio::compareLinearizedDiff) {
-        TOY_ASSERT_MESSAGE(false, "not implemented");
-        validStep = false;
+        validStep = linearizedDiff > 0.0;
+        stepRatio = validStep ? errDiff / linearizedDiff : 0.0;
       }
 
-      double errDiff        = currErrSq - newErrSq;
-      bool   successfulStep = errDiff > 0 && validStep;
+      bool successfulStep = errDiff > 0 && validStep;
 
       if (successfulStep) {
-        lambda *= std::max(1.0 / 3.0, 1.0 - std::pow(2.0 * errDiff - 1.0, 3.0));
+        lambda *= std::max(1.0 / 3.0, 1.0 - std::pow(2.0 * stepRatio - 1.0, 3.0));
         lambda = std::max(minLambda, lambda);
 
         mu = mOption.mMu;
 
         ++iter;
+        mSummary.finalCost = newErrSq;
 
         double stepSize = frameDelta.array().abs().maxCoeff();
         //ToyLogD("frame delta : {}", ToyLogger::eigenVec(frameDelta, 4));
@@ -239,6 +461,17 @@ bool SqrtProblem::solve() {
     }
   }
 
+  mSummary.iterations           = iter;
+  mSummary.successfulIterations = successfulIter;
+  mSummary.converged            = converged;
+
+  if (Config::Vio::solverLogDebug && mSummary.stoppedOnBudget) {
+    ToyLogD("stopped on budget after {} iterations, error {:03.2f}->{:03.2f}",
+            iter,
+            mSummary.initialCost,
+            mSummary.finalCost);
+  }
+
   //const auto nTwb0 = frames.front()->getTwb();
   //const auto del   = iTwb0 * nTwb0.inverse();
   //for (auto& f : frames) {
@@ -249,25 +482,43 @@ bool SqrtProblem::solve() {
   return true;
 }
 
-double SqrtProblem::linearize(bool updateState) {
-  double errSq = 0;
+template <typename Scalar>
+double SqrtProblem<Scalar>::poseOnlyLinearizedDiff(const Eigen::VectorXd& frameDelta) {
+  double diff = 0.0;
+  for (auto& cost : mPoseOnlyReprojectionCosts) {
+    const auto            col  = mFrameIdColumnMap[cost->getFrame()->id()];
+    const Eigen::Vector2d Jinc = cost->J_f0() * frameDelta.segment<POSE_SIZE>(col);
+    diff -= Jinc.dot(cost->Res() + 0.5 * Jinc);
+  }
+  return diff;
+}
 
-  if (Config::Vio::tbb) {
-    auto sumErrorSq = [&](const tbb::blocked_range<size_t>& r, double error) {
-      for (size_t i = r.begin(); i != r.end(); ++i) {
-        auto& mpL = mMapPointLinearizations[i];
-        error += mpL->linearize(updateState);
-      }
-      return error;
-    };
+template <typename Scalar>
+double SqrtProblem<Scalar>::linearize(bool updateState) {
+  double errSq = 0;
 
-    auto                       mpLinearizationSize = mMapPointLinearizations.size();
-    tbb::blocked_range<size_t> range(0, mpLinearizationSize);
-    errSq = tbb::parallel_reduce(range, double(0), sumErrorSq, std::plus<double>());
+  for (size_t i = 0; i < mRelativePoseSize; ++i) {
+    mRelativePoses[i]->update();
   }
-  else {
-    for (auto& mpL : mMapPointLinearizations) {
-      errSq += mpL->linearize(updateState);
+
+  errSq += mReprojectionBatch->linearize(updateState);
+
+  if (updateState) {
+    if (Config::Vio::tbb) {
+      auto copyRows = [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t i = r.begin(); i != r.end(); ++i) {
+          mMapPointLinearizations[i]->linearize();
+        }
+      };
+
+      auto                       mpLinearizationSize = mMapPointLinearizations.size();
+      tbb::blocked_range<size_t> range(0, mpLinearizationSize);
+      tbb::parallel_for(range, copyRows);
+    }
+    else {
+      for (auto& mpL : mMapPointLinearizations) {
+        mpL->linearize();
+      }
     }
   }
 
@@ -285,7 +536,8 @@ double SqrtProblem::linearize(bool updateState) {
   return errSq;
 }
 
-void SqrtProblem::decomposeLinearization() {
+template <typename Scalar>
+void SqrtProblem<Scalar>::decomposeLinearization() {
   if (Config::Vio::tbb) {
     auto decompose = [&](const tbb::blocked_range<size_t>& r) {
       for (size_t i = r.begin(); i != r.end(); ++i) {
@@ -312,18 +564,23 @@ void SqrtProblem::decomposeLinearization() {
 #endif
 }
 
-void SqrtProblem::getQRJacobian(Eigen::MatrixXd& Q2t_J, Eigen::VectorXd& Q2t_C) {
-  size_t     rows = 0u;
+template <typename Scalar>
+void SqrtProblem<Scalar>::getQRJacobian(Eigen::MatrixXd& Q2t_J,
+                                        Eigen::VectorXd& Q2t_C,
+                                        size_t           extraRows) {
+  size_t     rows = extraRows;
   const auto cols = mFrames->size() * db::Frame::PARAMETER_SIZE;
 
   for (auto& linearization : mMapPointLinearizations) {
-    rows += (linearization->J().rows() - MP_SIZE);
+    rows += linearization->reducedRows();
   }
 
   if (mSqrtMarginalizationCost) {
     rows += mSqrtMarginalizationCost->rows();
   }
 
+  rows += mPoseOnlyReprojectionCosts.size() * COST_SIZE;
+
   Q2t_J.resize(rows, cols);
   Q2t_C.resize(rows);
   Q2t_J.setZero();
@@ -331,40 +588,105 @@ void SqrtProblem::getQRJacobian(Eigen::MatrixXd& Q2t_J, Eigen::VectorXd& Q2t_C)
 
   size_t currRow = 0;
   for (auto& linearization : mMapPointLinearizations) {
-    auto blockRow = linearization->J().rows() - MP_SIZE;
-    // clang-format off
-    auto& Q2t_J_block = 
-    Q2t_J.block(currRow, 0, blockRow, cols) 
-      = linearization->J().bottomLeftCorner(blockRow, cols);
-    Q2t_C.segment(currRow, blockRow) = linearization->Res().tail(blockRow);
-    // clang-format on
-    currRow += blockRow;
+    linearization->addToQRJacobian(Q2t_J, Q2t_C, currRow);
   }
 
   if (mSqrtMarginalizationCost) {
     mSqrtMarginalizationCost->addToQRJacobian(Q2t_J, Q2t_C, currRow);
   }
+
+  for (auto& cost : mPoseOnlyReprojectionCosts) {
+    auto col = mFrameIdColumnMap[cost->getFrame()->id()];
+
+    Q2t_J.block<COST_SIZE, POSE_SIZE>(currRow, col) = cost->J_f0();
+    Q2t_C.segment<COST_SIZE>(currRow)               = cost->Res();
+    currRow += COST_SIZE;
+  }
 }
 
-void SqrtProblem::constructFrameHessian() {
-  const int Hrows = mFrames->size() * db::Frame::PARAMETER_SIZE;
+template <typename Scalar>
+void SqrtProblem<Scalar>::constructReducedQR() {
+  getQRJacobian(mQ2tJ, mQ2tC);
 
-  //YSTODO tbb
-  for (auto& mpL : mMapPointLinearizations) {
-    const Eigen::MatrixXd& vJ = mpL->J();
+  const auto rows = mQ2tJ.rows();
+  const auto cols = mQ2tJ.cols();
+  const auto rank = std::min(rows, cols);
+
+  mReducedQR.compute(mQ2tJ);
+
+  //min |J dx + C| -> min |R dx + Qt C|, rows below cols only hold the final error
+  mQ2tC.applyOnTheLeft(mReducedQR.householderQ().adjoint());
 
-    const Eigen::VectorXd& vRes = mpL->Res();
+  mReducedR.setZero(cols, cols);
+  mReducedR.topRows(rank) =
+    mReducedQR.matrixQR().topRows(rank).template triangularView<Eigen::Upper>();
+  mReducedD.setZero(cols);
+  mReducedD.head(rank) = -mQ2tC.head(rank);
 
-    const auto  rows = vJ.rows() - db::MapPoint::PARAMETER_SIZE;
-    const auto& cols = Hrows;
+  //damping follows the diagonal of Jt J like the hessian path. with R = U S Vt in scaled
+  //columns, every trial is then a diagonal solve instead of a new factorization
+  mReducedScale = mReducedR.colwise().norm().transpose();
+  mReducedScale = (mReducedScale.array() > 0.0).select(mReducedScale, 1.0);
+  mReducedSVD.compute(mReducedR * mReducedScale.cwiseInverse().asDiagonal(),
+                      Eigen::ComputeThinU | Eigen::ComputeThinV);
+  mReducedUtD.noalias() = mReducedSVD.matrixU().transpose() * mReducedD;
+}
+
+template <typename Scalar>
+void SqrtProblem<Scalar>::solveDampedQR(double           lambda,
+                                        double           minLambda,
+                                        Eigen::VectorXd& delta) {
+  //y = S dx solves (Rs^t Rs + lambda) y = Rs^t D with Rs = R S^-1 = U sigma Vt
+  const auto&  sigma   = mReducedSVD.singularValues();
+  const double damping = std::max(lambda, minLambda);
+  mDampedWeights =
+    (sigma.array() * mReducedUtD.array() / (sigma.array().square() + damping)).matrix();
+
+  delta.noalias() = mReducedSVD.matrixV() * mDampedWeights;
+  delta.array() /= mReducedScale.array();
+}
 
-    const Eigen::MatrixXd J   = vJ.bottomLeftCorner(rows, cols);
-    const Eigen::VectorXd Res = vRes.bottomRows(rows);
+template <typename Scalar>
+void SqrtProblem<Scalar>::constructFrameHessian() {
+  //landmark blocks are summed in Scalar, the frame system itself stays in double
+  const auto Hrows = mH.rows();
 
-    Eigen::MatrixXd Jt = J.transpose();
+  if (Config::Vio::tbb) {
+    auto reset = [Hrows](HessianAccumulator& acc) {
+      acc.H.setZero(Hrows, Hrows);
+      acc.B.setZero(Hrows);
+    };
+    resetWorkspaces(mHessianAccumulators, reset);
 
-    mH += Jt * J;
-    mB -= Jt * Res;
+    auto addLandmarks = [&](const tbb::blocked_range<size_t>& r) {
+      auto& acc = localWorkspace(mHessianAccumulators, reset);
+      for (size_t i = r.begin(); i != r.end(); ++i) {
+        mMapPointLinearizations[i]->addToHessian(acc.H, acc.B);
+      }
+    };
+
+    auto                       mpLSize = mMapPointLinearizations.size();
+    tbb::blocked_range<size_t> range(0, mpLSize);
+    tbb::parallel_for(range, addLandmarks);
+
+    for (const auto& acc : mHessianAccumulators) {
+      mH += acc.H.template cast<double>();
+      mB += acc.B.template cast<double>();
+    }
+  }
+  else if constexpr (std::is_same_v<Scalar, double>) {
+    for (auto& mpL : mMapPointLinearizations) {
+      mpL->addToHessian(mH, mB);
+    }
+  }
+  else {
+    mLandmarkH.setZero(Hrows, Hrows);
+    mLandmarkB.setZero(Hrows);
+    for (auto& mpL : mMapPointLinearizations) {
+      mpL->addToHessian(mLandmarkH, mLandmarkB);
+    }
+    mH += mLandmarkH.template cast<double>();
+    mB += mLandmarkB.template cast<double>();
   }
 
   for (auto& cost : mPoseOnlyReprojectionCosts) {
@@ -385,22 +707,319 @@ void SqrtProblem::constructFrameHessian() {
   }
 }
 
-void SqrtProblem::backupParameters() {
+template <typename Scalar>
+void SqrtProblem<Scalar>::constructSparseFrameHessian() {
+  mBlockH.resetPattern(mFrames->size());
+  for (auto& mpL : mMapPointLinearizations) {
+    mBlockH.addPattern(mpL->frameColumns());
+  }
+  if (mSqrtMarginalizationCost) {
+    mBlockH.addDensePattern(mSqrtMarginalizationCost->J().cols());
+  }
+
+  mLandmarkBlockH.setPattern(mBlockH);
+  mLandmarkBlockH.setZero();
+
+  if (Config::Vio::tbb) {
+    auto reset = [this](BlockHessian<Scalar>& acc) {
+      acc.setPattern(mLandmarkBlockH);
+      acc.setZero();
+    };
+    resetWorkspaces(mBlockAccumulators, reset);
+
+    auto addLandmarks = [&](const tbb::blocked_range<size_t>& r) {
+      auto& acc = localWorkspace(mBlockAccumulators, reset);
+      for (size_t i = r.begin(); i != r.end(); ++i) {
+        mMapPointLinearizations[i]->addToHessian(acc);
+      }
+    };
+
+    auto                       mpLSize = mMapPointLinearizations.size();
+    tbb::blocked_range<size_t> range(0, mpLSize);
+    tbb::parallel_for(range, addLandmarks);
+
+    for (const auto& acc : mBlockAccumulators) {
+      mLandmarkBlockH.add(acc);
+    }
+  }
+  else {
+    for (auto& mpL : mMapPointLinearizations) {
+      mpL->addToHessian(mLandmarkBlockH);
+    }
+  }
+
+  mBlockH.setZero();
+  mBlockH.add(mLandmarkBlockH);
+
+  for (auto& cost : mPoseOnlyReprojectionCosts) {
+    auto&            J   = cost->J_f0();
+    auto&            Res = cost->Res();
+    Eigen::Matrix62d Jt  = J.transpose();
+
+    auto col = mFrameIdColumnMap[cost->getFrame()->id()];
+    mBlockH.add(col, col, Jt * J);
+    mBlockH.b().segment<POSE_SIZE>(col) -= Jt * Res;
+  }
+
+  //the prior is dense over the kept frames, it enters as its upper blocks
+  if (mSqrtMarginalizationCost) {
+    const auto cols = mSqrtMarginalizationCost->J().cols();
+    mPriorH.setZero(cols, cols);
+    mPriorB.setZero(cols);
+    mSqrtMarginalizationCost->addToHessian(mPriorH, mPriorB);
+    mBlockH.addDense(mPriorH, mPriorB);
+  }
+
+  mBlockH.toSparse(mSparseH, mTriplets);
+  mB              = mBlockH.b();
+  mSparseDiagonal = mSparseH.diagonal();
+
+  if (mBlockH.pattern() != mAnalyzedPattern) {
+    mSparseLDLT.analyzePattern(mSparseH);
+    mAnalyzedPattern = mBlockH.pattern();
+  }
+}
+
+template <typename Scalar>
+void SqrtProblem<Scalar>::solveDampedSparse(double           lambda,
+                                            double           minLambda,
+                                            Eigen::VectorXd& delta) {
+  mDampedSparseH = mSparseH;
+  for (Eigen::Index i = 0; i < mSparseDiagonal.size(); ++i) {
+    mDampedSparseH.coeffRef(i, i) += std::max(mSparseDiagonal[i] * lambda, minLambda);
+  }
+
+  mSparseLDLT.factorize(mDampedSparseH);
+  if (mSparseLDLT.info() != Eigen::Success) {
+    delta.setConstant(mB.size(), std::numeric_limits<double>::quiet_NaN());
+    return;
+  }
+  delta = mSparseLDLT.solve(mB);
+}
+
+template <typename Scalar>
+void SqrtProblem<Scalar>::constructPCGSystem() {
+  const auto Hrows = mH.rows();
+
+  if (Config::Vio::tbb) {
+    auto reset = [Hrows](HessianAccumulator& acc) {
+      acc.H.setZero(POSE_SIZE, Hrows);
+      acc.B.setZero(Hrows);
+    };
+    resetWorkspaces(mDiagonalAccumulators, reset);
+
+    auto addLandmarks = [&](const tbb::blocked_range<size_t>& r) {
+      auto& acc = localWorkspace(mDiagonalAccumulators, reset);
+      for (size_t i = r.begin(); i != r.end(); ++i) {
+        mMapPointLinearizations[i]->addToBlockDiagonal(acc.H, acc.B);
+      }
+    };
+
+    auto                       mpLSize = mMapPointLinearizations.size();
+    tbb::blocked_range<size_t> range(0, mpLSize);
+    tbb::parallel_for(range, addLandmarks);
+
+    mBlockDiagonal.setZero(POSE_SIZE, Hrows);
+    mB.setZero();
+    for (const auto& acc : mDiagonalAccumulators) {
+      mBlockDiagonal += acc.H.template cast<double>();
+      mB += acc.B.template cast<double>();
+    }
+  }
+  else {
+    mLandmarkDiagonal.setZero(POSE_SIZE, Hrows);
+    mLandmarkB.setZero(Hrows);
+    for (auto& mpL : mMapPointLinearizations) {
+      mpL->addToBlockDiagonal(mLandmarkDiagonal, mLandmarkB);
+    }
+    mBlockDiagonal = mLandmarkDiagonal.template cast<double>();
+    mB             = mLandmarkB.template cast<double>();
+  }
+
+  for (auto& cost : mPoseOnlyReprojectionCosts) {
+    auto&            J   = cost->J_f0();
+    Eigen::Matrix62d Jt  = J.transpose();
+    auto             col = mFrameIdColumnMap[cost->getFrame()->id()];
+
+    mBlockDiagonal.middleCols<POSE_SIZE>(col) += Jt * J;
+    mB.segment<POSE_SIZE>(col) -= Jt * cost->Res();
+  }
+
+  //the prior is small and dense, it is applied as a matrix
+  if (mSqrtMarginalizationCost) {
+    const auto cols = mSqrtMarginalizationCost->J().cols();
+    mPriorH.setZero(cols, cols);
+    mPriorB.setZero(cols);
+    mSqrtMarginalizationCost->addToHessian(mPriorH, mPriorB);
+
+    for (Eigen::Index c = 0; c < cols; c += POSE_SIZE) {
+      mBlockDiagonal.middleCols<POSE_SIZE>(c) += mPriorH.block<POSE_SIZE, POSE_SIZE>(c, c);
+    }
+    mB.head(cols) += mPriorB;
+  }
+
+  mHessianDiagonal.resize(Hrows);
+  for (Eigen::Index c = 0; c < Hrows; c += POSE_SIZE) {
+    mHessianDiagonal.segment<POSE_SIZE>(c) =
+      mBlockDiagonal.middleCols<POSE_SIZE>(c).diagonal();
+  }
+}
+
+template <typename Scalar>
+void SqrtProblem<Scalar>::applyFrameHessian(const Eigen::VectorXd& x, Eigen::VectorXd& y) {
+  const auto Hrows = x.size();
+  mPCGx            = x.template cast<Scalar>();
+
+  if (Config::Vio::tbb) {
+    using VectorX = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
+    auto reset    = [Hrows](VectorX& acc) { acc.setZero(Hrows); };
+    resetWorkspaces(mProductAccumulators, reset);
+
+    auto multiply = [&](const tbb::blocked_range<size_t>& r) {
+      auto& acc = localWorkspace(mProductAccumulators, reset);
+      for (size_t i = r.begin(); i != r.end(); ++i) {
+        mMapPointLinearizations[i]->addHessianProduct(mPCGx, acc);
+      }
+    };
+
+    auto                       mpLSize = mMapPointLinearizations.size();
+    tbb::blocked_range<size_t> range(0, mpLSize);
+    tbb::parallel_for(range, multiply);
+
+    y.setZero(Hrows);
+    for (const auto& acc : mProductAccumulators) {
+      y += acc.template cast<double>();
+    }
+  }
+  else {
+    mPCGy.setZero(Hrows);
+    for (auto& mpL : mMapPointLinearizations) {
+      mpL->addHessianProduct(mPCGx, mPCGy);
+    }
+    y = mPCGy.template cast<double>();
+  }
+
+  for (auto& cost : mPoseOnlyReprojectionCosts) {
+    auto& J   = cost->J_f0();
+    auto  col = mFrameIdColumnMap[cost->getFrame()->id()];
+
+    y.segment<POSE_SIZE>(col) += J.transpose() * (J * x.segment<POSE_SIZE>(col));
+  }
+
+  if (mSqrtMarginalizationCost) {
+    const auto cols = mPriorH.cols();
+    y.head(cols) += mPriorH * x.head(cols);
+  }
+}
+
+template <typename Scalar>
+void SqrtProblem<Scalar>::solveDampedPCG(double           lambda,
+                                         double           minLambda,
+                                         Eigen::VectorXd& delta) {
+  const Eigen::Index Hrows  = mB.size();
+  const Eigen::Index blocks = Hrows / POSE_SIZE;
+
+  mPCGDamping = (mHessianDiagonal * lambda).cwiseMax(minLambda);
+
+  mPreconditioner.resize(blocks);
+  for (Eigen::Index i = 0; i < blocks; ++i) {
+    Matrix6d block = mBlockDiagonal.middleCols<POSE_SIZE>(i * POSE_SIZE);
+    block.diagonal() += mPCGDamping.segment<POSE_SIZE>(i * POSE_SIZE);
+    mPreconditioner[i] = block.ldlt().solve(Matrix6d::Identity());
+  }
+
+  auto precondition = [&](const Eigen::VectorXd& r, Eigen::VectorXd& z) {
+    z.resize(Hrows);
+    for (Eigen::Index i = 0; i < blocks; ++i) {
+      z.segment<POSE_SIZE>(i * POSE_SIZE).noalias() =
+        mPreconditioner[i] * r.segment<POSE_SIZE>(i * POSE_SIZE);
+    }
+  };
+
+  delta.setZero(Hrows);
+  mPCGr = mB;
+  precondition(mPCGr, mPCGz);
+  mPCGp = mPCGz;
+
+  double       rz        = mPCGr.dot(mPCGz);
+  const double tolerance = Config::Vio::pcgTolerance * mB.norm();
+
+  for (int i = 0; i < Config::Vio::pcgMaxIteration && mPCGr.norm() > tolerance; ++i) {
+    applyFrameHessian(mPCGp, mPCGAp);
+    mPCGAp += mPCGDamping.cwiseProduct(mPCGp);
+
+    const double pAp = mPCGp.dot(mPCGAp);
+    if (pAp <= 0.0) {
+      break;
+    }
+    const double alpha = rz / pAp;
+    delta += alpha * mPCGp;
+    mPCGr -= alpha * mPCGAp;
+
+    precondition(mPCGr, mPCGz);
+    const double rzNext = mPCGr.dot(mPCGz);
+    mPCGp               = mPCGz + (rzNext / rz) * mPCGp;
+    rz                  = rzNext;
+  }
+}
+
+template <typename Scalar>
+double SqrtProblem<Scalar>::backSubstitue(const Eigen::VectorXd& frameDelta) {
+  const auto mpLSize = mMapPointLinearizations.size();
+
+  if (Config::Vio::tbb) {
+    auto substitute = [&](const tbb::blocked_range<size_t>& r, double diff) {
+      for (size_t i = r.begin(); i != r.end(); ++i) {
+        diff += mMapPointLinearizations[i]->backSubstitue(frameDelta);
+      }
+      return diff;
+    };
+    tbb::blocked_range<size_t> range(0, mpLSize);
+    return tbb::parallel_reduce(range, 0.0, substitute, std::plus<double>());
+  }
+
+  double diff = 0.0;
+  for (auto& mpL : mMapPointLinearizations) {
+    diff += mpL->backSubstitue(frameDelta);
+  }
+  return diff;
+}
+
+template <typename Scalar>
+void SqrtProblem<Scalar>::backupParameters() {
+  //the window only has a few frames, points go to one contiguous array
   for (auto& f : *mFrames) {
     f->backup();
   }
 
-  for (auto& mp : *mMapPoints) {
-    mp->backup();
+  const auto& mapPoints = *mMapPoints;
+  const auto  mpSize    = Eigen::Index(mapPoints.size());
+  if (mMapPointBackup.cols() < mpSize) {
+    mMapPointBackup.resize(Eigen::NoChange, mpSize << 1);
   }
+
+  auto backup = [&](size_t i) {
+    auto& mp = mapPoints[i];
+    mMapPointBackup.col(i) << mp->undist(), mp->invDepth();
+  };
+  forEachIndex(mapPoints.size(), backup);
 }
 
-void SqrtProblem::restoreParameters() {
+template <typename Scalar>
+void SqrtProblem<Scalar>::restoreParameters() {
   for (auto& f : *mFrames) {
     f->restore();
   }
-  for (auto& mp : *mMapPoints) {
-    mp->restore();
-  }
+
+  const auto& mapPoints = *mMapPoints;
+  auto        restore   = [&](size_t i) {
+    auto& mp          = mapPoints[i];
+    mp->getUndist()   = mMapPointBackup.col(i).head<2>();
+    mp->getInvDepth() = mMapPointBackup(2, i);
+  };
+  forEachIndex(mapPoints.size(), restore);
 }
+
+template class SqrtProblem<float>;
+template class SqrtProblem<double>;
 }  //namespace toy
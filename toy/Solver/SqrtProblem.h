@@ -1,9 +1,15 @@
 #pragma once
+#include <memory>
+#include <tuple>
 #include <vector>
 #include <map>
 #include <Eigen/Dense>
+#include <tbb/enumerable_thread_specific.h>
 
 #include "macros.h"
+#include "FlatMap.h"
+#include "VioSolver.h"
+#include "BlockHessian.h"
 
 namespace toy {
 namespace db {
@@ -12,8 +18,22 @@ class MapPoint;
 }  //namespace db
 class SqrtMarginalizationCost;
 class PoseOnlyReporjectinCost;
-class ReprojectionCost;
+class MEstimator;
+class RelativePose;
+template <typename Scalar>
+class ReprojectionBatch;
+template <typename Scalar>
 class MapPointLinearization;
+
+/** @brief factorization of the reduced camera system */
+enum class LinearSolver { LDLT, QR, SPARSE_LDLT, PCG };
+
+/**
+ * @brief sliding window problem with square root landmark elimination. Scalar is the
+ * precision of the landmark linearization, QR and hessian blocks; the frame system, the
+ * state update and the marginalization prior are always double.
+ */
+template <typename Scalar>
 class SqrtProblem {
 public:
   USING_SMART_PTR(SqrtProblem);
@@ -27,58 +47,176 @@ public:
   void addPoseOnlyReprojectionCost(
     std::vector<std::shared_ptr<PoseOnlyReporjectinCost>>& costs);
 
-  void addReprojectionCost(std::shared_ptr<db::MapPoint>                   mp,
-                           std::vector<std::shared_ptr<ReprojectionCost>>& costs);
+  void setReprojectionMEstimator(std::shared_ptr<MEstimator> ME);
+
+  /** @brief transform shared by the costs of a host/target/camera triple */
+  const RelativePose* relativePose(db::Frame* frame0, db::Frame* frame1, size_t camId1);
+
+  /** @brief linearization reused from the last solve when mp is still in the window */
+  MapPointLinearization<Scalar>& addMapPointLinearization(std::shared_ptr<db::MapPoint> mp);
 
   void addMarginalizationCost(std::shared_ptr<SqrtMarginalizationCost> cost);
 
-  std::vector<std::shared_ptr<MapPointLinearization>> grepMarginMapPointLinearizations(
-    std::vector<std::shared_ptr<db::MapPoint>>& mps);
+  /** @brief linearizations of mps in the same order, nullptr for points not in the problem */
+  std::vector<std::shared_ptr<MapPointLinearization<Scalar>>>
+  grepMarginMapPointLinearizations(std::vector<std::shared_ptr<db::MapPoint>>& mps);
+
+  /**
+   * @brief rebuild and factor the given linearizations at the current state. only their
+   * batch rows are evaluated, stale factors are never kept here.
+   */
+  void relinearize(std::vector<std::shared_ptr<MapPointLinearization<Scalar>>>& mpLs);
 
   bool solve();
 
+  const SolverSummary& summary() const { return mSummary; }
+
   double linearize(bool updateState);
   void   decomposeLinearization();
 
-  void getQRJacobian(Eigen::MatrixXd& Q2t_J, Eigen::VectorXd& Q2t_C);
+  /** @brief extraRows are left zero at the bottom for the caller */
+  void getQRJacobian(Eigen::MatrixXd& Q2t_J, Eigen::VectorXd& Q2t_C, size_t extraRows = 0);
 
 protected:
   void constructFrameHessian();
-  void backupParameters();
-  void restoreParameters();
+
+  /** @brief L(0) - L(dx) of the pose-only costs */
+  double poseOnlyLinearizedDiff(const Eigen::VectorXd& frameDelta);
+
+  /**
+   * @brief factor the stacked reduced jacobian once per linearization, R by QR and the
+   * column scaled R by SVD. both are O(n^3) but only paid once per linearization
+   */
+  void constructReducedQR();
+  /**
+   * @brief damped step from the SVD of the reduced R, O(n^2) per lambda trial. it never
+   * squares the condition number of J.
+   */
+  void solveDampedQR(double lambda, double minLambda, Eigen::VectorXd& delta);
+
+  /** @brief block sparse reduced system, the symbolic factorization follows the pattern */
+  void constructSparseFrameHessian();
+  void solveDampedSparse(double lambda, double minLambda, Eigen::VectorXd& delta);
+
+  /** @brief matrix free system, only the block jacobi preconditioner and B are formed */
+  void constructPCGSystem();
+  void solveDampedPCG(double lambda, double minLambda, Eigen::VectorXd& delta);
+  /** @brief y = H x over the landmark blocks, the prior and the pose-only costs */
+  void applyFrameHessian(const Eigen::VectorXd& x, Eigen::VectorXd& y);
+
+  /** @brief update every landmark from the frame step, returns the model cost change */
+  double backSubstitue(const Eigen::VectorXd& frameDelta);
+  void   backupParameters();
+  void   restoreParameters();
 
 public:
   struct Option {
     Option();
-    int    mMaxIteration;
-    double mLambda;
-    double mMaxLambda;
-    double mMinLambda;
-    double mMu;
-    double mMuFactor;
+    LinearSolver mLinearSolver;
+    int          mMaxIteration;
+    double       mLambda;
+    double       mMaxLambda;
+    double       mMinLambda;
+    double       mMu;
+    double       mMuFactor;
+    uint64_t     mDeadlineNs;  //steady clock, 0 for no deadline
   } mOption;
 
 protected:
   //std::map<int, FrameParameter>*                      mFrameParameterMapRpt;
   //std::map<int, MapPointParameter>*                   mMapPointParameterMapRpt;
-  std::map<int64_t, size_t>                         mFrameIdColumnMap;
+  FlatMap<int64_t, size_t>                          mFrameIdColumnMap;
   const std::vector<std::shared_ptr<db::Frame>>*    mFrames;
   const std::vector<std::shared_ptr<db::MapPoint>>* mMapPoints;
 
-  std::vector<std::shared_ptr<MapPointLinearization>> mMapPointLinearizations;
+  std::unique_ptr<ReprojectionBatch<Scalar>>                  mReprojectionBatch;
+  std::vector<std::shared_ptr<MapPointLinearization<Scalar>>> mMapPointLinearizations;
+  std::vector<size_t>                                         mRelinearizeHandles;
+
+  //refreshed once per linearize, pooled like the linearizations
+  using RelativePoseKey = std::tuple<int64_t, int64_t, size_t>;
+  FlatMap<RelativePoseKey, RelativePose*>    mRelativePoseMap;
+  std::vector<std::unique_ptr<RelativePose>> mRelativePoses;
+  size_t                                     mRelativePoseSize;
+
+  //workspace kept between solves
+  FlatMap<int64_t, std::shared_ptr<MapPointLinearization<Scalar>>> mLinearizationPool;
+  std::vector<std::shared_ptr<MapPointLinearization<Scalar>>>     mSpareLinearizations;
 
   std::vector<std::shared_ptr<PoseOnlyReporjectinCost>> mPoseOnlyReprojectionCosts;
   std::shared_ptr<SqrtMarginalizationCost>              mSqrtMarginalizationCost;
 
+  SolverSummary mSummary;
+
+  //undist and inverse depth of each map point before a step
+  Eigen::Matrix3Xd mMapPointBackup;
+
   Eigen::MatrixXd mH;
   Eigen::VectorXd mB;
 
+  //serial landmark accumulation when Scalar is not double
+  Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> mLandmarkH;
+  Eigen::Matrix<Scalar, Eigen::Dynamic, 1>              mLandmarkB;
+
+  //per thread landmark sums, kept across calls and only zeroed
+  struct HessianAccumulator {
+    Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> H;
+    Eigen::Matrix<Scalar, Eigen::Dynamic, 1>              B;
+  };
+  template <typename T>
+  using ThreadLocal = tbb::enumerable_thread_specific<T>;
+  ThreadLocal<HessianAccumulator>                       mHessianAccumulators;
+  ThreadLocal<HessianAccumulator>                       mDiagonalAccumulators;
+  ThreadLocal<BlockHessian<Scalar>>                     mBlockAccumulators;
+  ThreadLocal<Eigen::Matrix<Scalar, Eigen::Dynamic, 1>> mProductAccumulators;
+
+  Eigen::MatrixXd              mDampedH;
+  Eigen::VectorXd              mFrameDelta;
+  Eigen::LDLT<Eigen::MatrixXd> mLDLT;
+
+  //square root form of the reduced system, min |R dx - D|
+  Eigen::MatrixXd                       mQ2tJ;
+  Eigen::VectorXd                       mQ2tC;
+  Eigen::HouseholderQR<Eigen::MatrixXd> mReducedQR;
+  Eigen::MatrixXd                       mReducedR;
+  Eigen::VectorXd                       mReducedD;
+  Eigen::VectorXd                       mReducedScale;  //column norms of R
+  Eigen::BDCSVD<Eigen::MatrixXd>        mReducedSVD;
+  Eigen::VectorXd                       mReducedUtD;
+  Eigen::VectorXd                       mDampedWeights;
+
+  //block sparse form of the reduced system for large windows
+  BlockHessian<double>                               mBlockH;
+  BlockHessian<Scalar>                               mLandmarkBlockH;
+  Eigen::MatrixXd                                    mPriorH;
+  Eigen::VectorXd                                    mPriorB;
+  Eigen::SparseMatrix<double>                        mSparseH;
+  Eigen::SparseMatrix<double>                        mDampedSparseH;
+  Eigen::VectorXd                                    mSparseDiagonal;
+  std::vector<Eigen::Triplet<double>>                mTriplets;
+  std::vector<std::pair<int, int>>                   mAnalyzedPattern;
+  Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> mSparseLDLT;
+
+  //pcg workspace, mBlockDiagonal holds the 6x6 diagonal blocks side by side
+  using Matrix6d = Eigen::Matrix<double, 6, 6>;
+  Eigen::MatrixXd                                       mBlockDiagonal;
+  std::vector<Matrix6d>                                 mPreconditioner;
+  Eigen::Matrix<Scalar, Eigen::Dynamic, 1>              mPCGx;
+  Eigen::Matrix<Scalar, Eigen::Dynamic, 1>              mPCGy;
+  Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> mLandmarkDiagonal;
+  Eigen::VectorXd                                       mHessianDiagonal;
+  Eigen::VectorXd                                       mPCGDamping;
+  Eigen::VectorXd                                       mPCGr;
+  Eigen::VectorXd                                       mPCGz;
+  Eigen::VectorXd                                       mPCGp;
+  Eigen::VectorXd                                       mPCGAp;
+
 public:
   std::shared_ptr<SqrtMarginalizationCost> getSqrtMarginalizationCost() {
     return mSqrtMarginalizationCost;
   }
 
-  std::map<int64_t, size_t>& getFrameIdColumnMap() { return mFrameIdColumnMap; };
+  FlatMap<int64_t, size_t>& getFrameIdColumnMap() { return mFrameIdColumnMap; };
 
   auto& mapPointLinearizations() { return mMapPointLinearizations; }
 };
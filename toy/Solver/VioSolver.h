@@ -10,6 +10,16 @@ namespace db {
 class Frame;
 class MapPoint;
 }  //namespace db
+/** @brief outcome of the last solve */
+struct SolverSummary {
+  int    iterations           = 0;
+  int    successfulIterations = 0;
+  double initialCost          = 0.0;
+  double finalCost            = 0.0;
+  bool   converged            = false;
+  bool   stoppedOnBudget      = false;
+};
+
 class VioSolver {
 public:
   USING_SMART_PTR(VioSolver);
@@ -23,7 +33,14 @@ public:
     std::set<int64_t>&                                marginalkeyFrameIds,
     std::forward_list<std::shared_ptr<db::MapPoint>>& marginalMapPoints) = 0;
 
+  /** @brief wall time of the next solve in milliseconds, <= 0 for no limit */
+  void setTimeBudget(double ms) { mTimeBudgetMs = ms; }
+
+  const SolverSummary& summary() const { return mSummary; }
+
 protected:
+  double        mTimeBudgetMs = 0.0;
+  SolverSummary mSummary;
 };
 
 class VioSolverFactory {
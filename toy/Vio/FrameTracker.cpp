@@ -6,7 +6,9 @@
 #include "ImagePyramid.h"
 #include "Frame.h"
 #include "LocalMap.h"
+#include "SLAMInfo.h"
 #include "FeatureTracker.h"
+#include "BasicSolver.h"
 #include "VioSolver.h"
 #include "FrameTracker.h"
 
@@ -50,7 +52,7 @@ void FrameTracker::process() {
   }
   case Status::TRACKING: {
     if (Config::Vio::frameTrackerSolvePose) {
-      trackPose();
+      trackPose(currFrame);
     }
     //db::MemoryPointerPool::release(mPrevFrame);
     break;
@@ -79,8 +81,43 @@ db::Frame::Ptr FrameTracker::getLatestFrame() {
   return currFrame;
 }
 
-void FrameTracker::trackPose() {
-  ToyLogW("Not implemented yet");
+void FrameTracker::setMapSnapshot(db::MapSnapshot::CPtr snapshot) {
+  std::unique_lock<std::mutex> lock(mMapSnapshotLock);
+  mMapSnapshot = snapshot;
+}
+
+bool FrameTracker::trackPose(db::Frame::Ptr currFrame) {
+  db::MapSnapshot::CPtr snapshot;
+  {
+    std::unique_lock<std::mutex> lock(mMapSnapshotLock);
+    snapshot = mMapSnapshot;
+  }
+
+  if (!snapshot) {
+    return false;
+  }
+
+  //prefer the refined pose when the window solve already caught up with prev frame
+  if (!mPrevFrame->poseTracked() || snapshot->mFrameId == mPrevFrame->id()) {
+    currFrame->setTwb(snapshot->mTwb);
+  }
+  else {
+    currFrame->setTwb(mPrevFrame->Twb());
+  }
+
+  bool OK = BasicSolver::solveFramePose(currFrame.get(), *snapshot);
+  currFrame->setPoseTracked(OK);
+
+  if (!OK) {
+    if (Config::Vio::debug) {
+      ToyLogD("frame to map tracking failed : {}", currFrame->id());
+    }
+    return false;
+  }
+
+  SLAMInfo::getInstance()->publishPose(currFrame.get(), PoseType::FRONTEND);
+
+  return true;
 }
 
 }  //namespace toy
\ No newline at end of file
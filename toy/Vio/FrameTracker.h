@@ -1,7 +1,9 @@
 #pragma once
 #include <memory>
+#include <mutex>
 #include <array>
 #include "ImagePyramid.h"
+#include "MapSnapshot.h"
 #include "Thread.h"
 
 namespace toy {
@@ -19,12 +21,14 @@ public:
   void prepare();
   void process();
 
+  void setMapSnapshot(db::MapSnapshot::CPtr snapshot);
+
 private:
   using Thread<db::ImagePyramidSet, db::Frame>::getLatestInput;
   using Thread<db::ImagePyramidSet, db::Frame>::in_queue_;
 
   std::shared_ptr<db::Frame> getLatestFrame();
-  void                       trackPose();
+  bool                       trackPose(std::shared_ptr<db::Frame> currFrame);
 
 private:
   enum class Status { NONE = -1, INITIALIZING = 0, TRACKING = 1 };
@@ -32,6 +36,9 @@ private:
   Status                     mStatus;
   FeatureTracker*            mFeatureTracker;
   std::shared_ptr<db::Frame> mPrevFrame;
+
+  std::mutex            mMapSnapshotLock;
+  db::MapSnapshot::CPtr mMapSnapshot;
 };
 
 }  //namespace toy
\ No newline at end of file
@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <set>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
 #include "ToyAssert.h"
 #include "SLAMInfo.h"
 #include "Feature.h"
@@ -6,19 +9,27 @@
 #include "Frame.h"
 #include "Factor.h"
 #include "LocalMap.h"
+#include "MapSnapshot.h"
+#include "FrameTracker.h"
 #include "LocalTracker.h"
 #include "BasicSolver.h"
 #include "VioSolver.h"
 
 namespace toy {
 namespace {
-constexpr bool NO_IMU = true;
+constexpr bool  NO_IMU             = true;
+constexpr float MAP_UPDATE_EPSILON = 1e-4f;
+
+void appendPoint(std::vector<float>& points, const Eigen::Vector3f& Pwx) {
+  points.insert(points.end(), {Pwx.x(), Pwx.y(), Pwx.z(), 1.0f});
 }
+}  //namespace
 LocalTracker::LocalTracker()
   : mStatus{Status::NONE}
   , mLocalMap{nullptr}
   , mKeyFrameAfter{0}
-  , mSetKeyFrame{false} {
+  , mSetKeyFrame{false}
+  , mFrameTracker{nullptr} {
   mMarginalFrameIds.reserve(Config::Vio::maxKeyFrameSize);
   TAG = "LocalTracker";
 }
@@ -78,8 +89,8 @@ void LocalTracker::process() {
   }
   case Status::TRACKING: {
     //YSTODO: changed if imu exists;
-    if (NO_IMU) {
-      auto& Twb = mLocalMap->getFrames().rbegin()->second->getTwb();
+    if (NO_IMU && !currFrame->poseTracked()) {
+      auto& Twb = mLocalMap->getFrames().back().second->getTwb();
       currFrame->setTwb(Twb);
     }
 
@@ -90,11 +101,28 @@ void LocalTracker::process() {
     std::vector<db::MapPoint::Ptr> trackingMapPoints;
     mLocalMap->getCurrentStates(frames, trackingMapPoints);
 
-    BasicSolver::solveFramePose(currFrame);
+    //frame tracker already solved against the same map points
+    if (!currFrame->poseTracked()) {
+      BasicSolver::solveFramePose(currFrame);
+    }
 
     //drawDebugView(100, 0);
 
+    mVioSolver->setTimeBudget(Config::Vio::solverTimeBudget);
     mVioSolver->solve(frames, trackingMapPoints);
+    for (auto& frame : frames) {
+      mSolvedFrameIds.push_back(frame->id());
+    }
+    if (Config::Vio::debug && mVioSolver->summary().stoppedOnBudget) {
+      auto& summary = mVioSolver->summary();
+      ToyLogD("{}th frame, solver stopped on budget. {} iters, error {:.2f}->{:.2f}",
+              currFrame->id(),
+              summary.iterations,
+              summary.initialCost,
+              summary.finalCost);
+    }
+    SLAMInfo::getInstance()->publishPose(currFrame.get(), PoseType::REFINED);
+
     auto& currFactorMap = currFrame->mapPointFactorMap(0u);
     float ratio         = float(connected) / float(currFactorMap.size());
 
@@ -157,6 +185,24 @@ void LocalTracker::process() {
       mLocalMap->removeFrame(id);
     }
 
+    //points left out of a capped solve still constrain the kept frames. they are moved to
+    //the solved frames first so the prior is not taken at their stale state. tracking map
+    //points come in id order
+    if (Config::Vio::solverMaxMapPoints > 0) {
+      auto byId = [](const db::MapPoint::Ptr& mp, int64_t id) { return mp->id() < id; };
+      for (auto& [id, mp] : mLocalMap->getMapPoints()) {
+        if (!mMarginalKeyFrameIds.count(mp->hostFrame()->id())) {
+          continue;
+        }
+        auto solved = std::lower_bound(
+          trackingMapPoints.begin(), trackingMapPoints.end(), id, byId);
+        if (solved == trackingMapPoints.end() || (*solved)->id() != id) {
+          BasicSolver::refineMapPoint(mp.get());
+          lostMapPoints.push_front(mp);
+        }
+      }
+    }
+
     mVioSolver->marginalize(mMarginalKeyFrameIds, lostMapPoints);
 
     for (auto id : mMarginalKeyFrameIds) {
@@ -167,6 +213,17 @@ void LocalTracker::process() {
     mMarginalFrameIds.clear();
     mMarginalKeyFrameIds.clear();
 
+    if (Config::Vio::debug) {
+      auto report = mLocalMap->report();
+      ToyLogD("local map frames : {}, mps : {}, cands : {}, edges : {}, live {} / {}",
+              report.frames,
+              report.mapPoints,
+              report.candidates,
+              report.edges,
+              report.liveFrames,
+              report.liveMapPoints);
+    }
+
     //if (currFrame->id() > 198) {
     //  drawDebugView(100, 0);
     //  DEBUG_POINT();
@@ -187,67 +244,59 @@ int LocalTracker::initializeMapPoints(std::shared_ptr<db::Frame> currFrame) {
   int oldCount  = 0;
   int tryCount  = mpCands.size();
 
-  FrameCamId        frameCamId0{currFrame->id(), 0};
-  std::set<int64_t> eraseMpIds;
+  FrameCamId frameCamId0{currFrame->id(), 0};
 
-  //YSTODO : tbb
+  //camera poses are read only while candidates are evaluated
+  std::map<int64_t, std::array<Sophus::SE3d, 2>> Tcws;
+  for (auto& [frameId, frame] : mLocalMap->getFrames()) {
+    Tcws[frameId] = {frame->getTwc(0).inverse(), frame->getTwc(1).inverse()};
+  }
+  const Sophus::SE3d Twc0 = currFrame->getTwc(frameCamId0.camId);
+
+  enum class Result { OLD, FAILED, SUCCESS };
+  struct Candidate {
+    db::MapPoint*   mp;
+    Result          result;
+    Eigen::Vector3d Pc0x;
+  };
+
+  std::vector<Candidate> candidates;
+  candidates.reserve(mpCands.size());
   for (auto& [mpId, mp] : mpCands) {
-    auto& frameFactorMap = mp->frameFactorMap();
+    candidates.push_back({mp.get(), Result::OLD, Eigen::Vector3d::Zero()});
+  }
 
-    if (frameFactorMap.count(frameCamId0) == 0) {
-      ++oldCount;
-      eraseMpIds.insert(mpId);
+  //observation pairs with enough baseline, pairs of a candidate stay contiguous
+  std::vector<size_t>          pairCandIdxs;
+  std::vector<Eigen::Vector3d> undist0s;
+  std::vector<Eigen::Vector3d> undist1s;
+  std::vector<Sophus::SE3d>    Tc1c0s;
+
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    auto& frameFactorMap = candidates[i].mp->frameFactorMap();
+    auto  it0            = frameFactorMap.find(frameCamId0);
+
+    if (it0 == frameFactorMap.end()) {
       continue;
     }
+    candidates[i].result = Result::FAILED;
 
-    auto& factor0 = frameFactorMap[frameCamId0];
-
-    bool initSuccess = false;
     for (auto& [frameCamId1, factor1] : frameFactorMap) {
       if (frameCamId0 == frameCamId1) {
         continue;
       }
 
-      Eigen::Vector3d Pc0x;
       switch (factor1.type()) {
       case db::Factor::Type::REPROJECTION: {
-        auto Twc0  = factor0.frame()->getTwc(frameCamId0.camId);
-        auto Twc1  = factor1.frame()->getTwc(frameCamId1.camId);
-        auto Tc1c0 = Twc1.inverse() * Twc0;
-
-        //auto image0 = factor0.frame()
-        //                ->getImagePyramid(frameCamId0.camId)
-        //                ->getOrigin()
-        //                .clone();
-        //auto image1 = factor1.frame()
-        //                ->getImagePyramid(frameCamId1.camId)
-        //                ->getOrigin()
-        //                .clone();
-
-        //cv::cvtColor(image0, image0, CV_GRAY2BGR);
-        //cv::cvtColor(image1, image1, CV_GRAY2BGR);
-        //cv::circle(image0,
-        //           cv::Point2f(factor0.uv().x(), factor0.uv().y()),
-        //           4,
-        //           {255, 0, 0},
-        //           -1);
-        //cv::circle(image1,
-        //           cv::Point2f(factor1.uv().x(), factor1.uv().y()),
-        //           4,
-        //           {255, 0, 0},
-        //           -1);
-        //cv::imshow("0", image0);
-        //cv::imshow("1", image1);
-        //cv::waitKey();
+        auto Tc1c0 = Tcws.at(frameCamId1.frameId)[frameCamId1.camId] * Twc0;
 
         if (Tc1c0.translation().squaredNorm() < 0.0025)
           continue;
 
-        initSuccess |= BasicSolver::triangulate(factor0.undist(),
-                                                factor1.undist(),
-                                                Tc1c0,
-                                                Pc0x);
-
+        pairCandIdxs.push_back(i);
+        undist0s.push_back(it0->second.undist());
+        undist1s.push_back(factor1.undist());
+        Tc1c0s.push_back(Tc1c0);
         break;
       }
       case db::Factor::Type::DEPTH: {
@@ -259,28 +308,81 @@ int LocalTracker::initializeMapPoints(std::shared_ptr<db::Frame> currFrame) {
         break;
       }
       }
+    }
+  }
 
-      if (initSuccess) {
-        mp->setHost(currFrame);
-        double          invD = 1.0 / Pc0x.z();
-        Eigen::Vector2d nuv  = Pc0x.head(2) * invD;
-        mp->setUndist(nuv);
-        mp->setInvDepth(invD);
-        mp->setState(db::MapPoint::Status::TRACKING);
-        mLocalMap->addMapPoint(mp);
+  const auto       pairSize = pairCandIdxs.size();
+  Eigen::Matrix3Xd U0(3, pairSize);
+  Eigen::Matrix3Xd U1(3, pairSize);
+  Eigen::Matrix3Xd Pc0xs(3, pairSize);
+  Eigen::ArrayXi   valid(pairSize);
+
+  BasicSolver::PoseColumns T(12, pairSize);
+  for (size_t k = 0; k < pairSize; ++k) {
+    Eigen::Matrix3d R   = Tc1c0s[k].rotationMatrix();
+    U0.col(k)           = undist0s[k];
+    U1.col(k)           = undist1s[k];
+    T.block<9, 1>(0, k) = Eigen::Map<const Eigen::Matrix<double, 9, 1>>(R.data());
+    T.block<3, 1>(9, k) = Tc1c0s[k].translation();
+  }
 
-        ++initCount;
-        break;
-      }
-    }
+  auto triangulateRange = [&](size_t begin, size_t end) {
+    const auto n = end - begin;
+    BasicSolver::triangulate(U0.middleCols(begin, n),
+                             U1.middleCols(begin, n),
+                             T.middleCols(begin, n),
+                             Pc0xs.middleCols(begin, n),
+                             valid.segment(begin, n));
+  };
+
+  if (Config::Vio::tbb) {
+    tbb::blocked_range<size_t> range(0, pairSize, 256);
+    tbb::parallel_for(range, [&](const tbb::blocked_range<size_t>& r) {
+      triangulateRange(r.begin(), r.end());
+    });
+  }
+  else if (pairSize > 0) {
+    triangulateRange(0, pairSize);
+  }
 
-    if (initSuccess) {
-      eraseMpIds.insert(mpId);
+  //first valid pair wins, same order as trying the pairs one by one
+  for (size_t k = 0; k < pairSize; ++k) {
+    auto& cand = candidates[pairCandIdxs[k]];
+    if (cand.result != Result::SUCCESS && valid(k)) {
+      cand.result = Result::SUCCESS;
+      cand.Pc0x   = Pc0xs.col(k);
     }
   }
 
-  for (auto& id : eraseMpIds) {
-    mpCands.erase(id);
+  //commit in candidate order, only this part touches the local map
+  for (auto& cand : candidates) {
+    auto* mp = cand.mp;
+    auto  id = mp->id();
+
+    switch (cand.result) {
+    case Result::OLD: {
+      ++oldCount;
+      //old ones are dropped with their observations
+      mLocalMap->eraseMapPointCandidate(id);
+      break;
+    }
+    case Result::SUCCESS: {
+      mp->setHost(currFrame.get());
+      double          invD = 1.0 / cand.Pc0x.z();
+      Eigen::Vector2d nuv  = cand.Pc0x.head(2) * invD;
+      mp->setUndist(nuv);
+      mp->setInvDepth(invD);
+      mp->setState(db::MapPoint::Status::TRACKING);
+
+      //promoted candidates keep their observations
+      mLocalMap->addMapPoint(*mpCands.find(id));
+      mpCands.erase(id);
+      ++initCount;
+      break;
+    }
+    default:
+      break;
+    }
   }
   auto candSize = mpCands.size();
 
@@ -419,24 +521,88 @@ void LocalTracker::setDataToInfo() {
   }
   info->setLocalPath(Mwcs);
 
-  auto& mpMap  = mLocalMap->getMapPoints();
-  auto  mpSize = mpMap.size();
+  auto& mpMap = mLocalMap->getMapPoints();
+  auto  delta = std::make_shared<MapDelta>(info->mapDeltaVersion() + 1);
+  mLocalMap->takeMapPointChanges(mAddedIds, mRemovedIds);
 
-  std::vector<float> outmp;
-  outmp.reserve(mpSize * 4);
-
-  for (auto& [key, mpPtr] : mpMap) {
-    if (mpPtr->status() < db::MapPoint::Status::TRACKING)
+  //removed last, a point added and dropped in between is then never published
+  for (auto id : mAddedIds) {
+    auto* mp = mpMap.find(id);
+    if (!mp || mPublishedPoints.count(id)) {
       continue;
+    }
+    Eigen::Vector3d Pwx  = (*mp)->getPwx();
+    Eigen::Vector3f Pwxf = Pwx.cast<float>();
+    mPublishedPoints.emplace(id, PublishedPoint{Pwx, Pwxf});
 
-    Eigen::Vector3d Pwx = mpPtr->getPwx();
-    outmp.push_back(Pwx.x());
-    outmp.push_back(Pwx.y());
-    outmp.push_back(Pwx.z());
-    outmp.push_back(1.0);
+    delta->mAddedIds.push_back(id);
+    appendPoint(delta->mAddedPoints, Pwxf);
   }
 
-  info->setLocalPoints(outmp);
+  //a point moves with its host frame, so every point hosted in the solved window is checked
+  if (!mSolvedFrameIds.empty()) {
+    std::sort(mSolvedFrameIds.begin(), mSolvedFrameIds.end());
+    for (auto& [id, mp] : mpMap) {
+      auto* host = mp->hostFrame();
+      auto  it   = mPublishedPoints.find(id);
+      if (!host || it == mPublishedPoints.end() ||
+          !std::binary_search(mSolvedFrameIds.begin(), mSolvedFrameIds.end(), host->id())) {
+        continue;
+      }
+      auto& published = it->second;
+      published.Pwx   = mp->getPwx();
+
+      Eigen::Vector3f Pwxf = published.Pwx.cast<float>();
+      if ((published.published - Pwxf).norm() > MAP_UPDATE_EPSILON) {
+        published.published = Pwxf;
+        delta->mUpdatedIds.push_back(id);
+        appendPoint(delta->mUpdatedPoints, Pwxf);
+      }
+    }
+    mSolvedFrameIds.clear();
+  }
+
+  for (auto id : mRemovedIds) {
+    if (mPublishedPoints.erase(id)) {
+      delta->mRemovedIds.push_back(id);
+    }
+  }
+
+  if (mFrameTracker && !frameMap.empty()) {
+    auto& latestFrame  = frameMap.back().second;
+    auto  snapshot     = std::make_shared<db::MapSnapshot>();
+    snapshot->mFrameId = latestFrame->id();
+    snapshot->mTwb     = latestFrame->getTwb();
+
+    //tracks are continuous, so a point the frame tracker can still match is observed by
+    //the latest frame. copying only those keeps the snapshot at feature count, not map size
+    auto& factorMap = latestFrame->mapPointFactorMap(0u);
+    snapshot->mPwxs.reserve(factorMap.size());
+    for (auto& [id, factor] : factorMap) {
+      auto it = mPublishedPoints.find(id);
+      if (it != mPublishedPoints.end()) {
+        snapshot->mPwxs.emplace(id, it->second.Pwx);
+      }
+    }
+    mFrameTracker->setMapSnapshot(snapshot);
+  }
+
+  if (!delta->empty()) {
+    info->setMapDelta(delta);
+
+    //full copy for readers that join late
+    if (delta->mVersion % SLAMInfo::MAP_RESYNC_INTERVAL == 1) {
+      std::vector<int64_t> ids;
+      std::vector<float>   points;
+      ids.reserve(mPublishedPoints.size());
+      points.reserve(mPublishedPoints.size() * 4);
+      for (auto& [id, published] : mPublishedPoints) {
+        ids.push_back(id);
+        appendPoint(points, published.published);
+      }
+      info->setLocalPoints(ids, points);
+    }
+  }
 }
 
 void LocalTracker::drawDebugView(int tag, int offset) {
@@ -3,6 +3,8 @@
 #include <set>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <Eigen/Dense>
 #include "Thread.h"
 
 namespace toy {
@@ -15,6 +17,7 @@ class Frame;
 
 class FeatureTracker;
 class FrameSolver;
+class FrameTracker;
 class LocalTracker : public Thread<db::Frame, void> {
 public:
   using Thread<db::Frame, void>::registerOutQueue;
@@ -24,6 +27,8 @@ public:
   void prepare();
   void process();
 
+  void registerFrameTracker(FrameTracker* frameTracker) { mFrameTracker = frameTracker; }
+
 private:
   using Thread<db::Frame, void>::getLatestInput;
   using Thread<db::Frame, void>::in_queue_;
@@ -46,6 +51,20 @@ private:
 
   std::vector<int64_t> mMarginalFrameIds;
   std::set<int64_t>    mMarginalKeyFrameIds;
+
+  FrameTracker* mFrameTracker;
+
+  //latest position of every published point and what readers of SLAMInfo hold
+  struct PublishedPoint {
+    Eigen::Vector3d Pwx;
+    Eigen::Vector3f published;
+  };
+  std::unordered_map<int64_t, PublishedPoint> mPublishedPoints;
+
+  //changes since the last publish, points hosted by solved frames are refreshed
+  std::vector<int64_t> mAddedIds;
+  std::vector<int64_t> mRemovedIds;
+  std::vector<int64_t> mSolvedFrameIds;
 };
 
 }  //namespace toy
\ No newline at end of file
@@ -23,6 +23,7 @@ void VioCore::prepare() {
   mLocalTracker = new LocalTracker();
 
   mFrameTracker->registerOutQueue(&(mLocalTracker->getInQueue()));
+  mLocalTracker->registerFrameTracker(mFrameTracker);
 
   mFrameTracker->prepare();
   mLocalTracker->prepare();
@@ -0,0 +1,83 @@
+#pragma once
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace toy {
+/**
+ * @brief std::map like container on a sorted vector. meant for small observation sets
+ * which are iterated far more often than modified.
+ */
+template <typename Key, typename Value>
+class FlatMap {
+public:
+  using value_type     = std::pair<Key, Value>;
+  using iterator       = typename std::vector<value_type>::iterator;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+  iterator       begin() { return mData.begin(); }
+  iterator       end() { return mData.end(); }
+  const_iterator begin() const { return mData.begin(); }
+  const_iterator end() const { return mData.end(); }
+
+  size_t size() const { return mData.size(); }
+  bool   empty() const { return mData.empty(); }
+  void   reserve(size_t n) { mData.reserve(n); }
+  void   clear() { mData.clear(); }
+
+  iterator find(const Key& key) {
+    auto it = lowerBound(key);
+    return (it != mData.end() && !(key < it->first)) ? it : mData.end();
+  }
+
+  const_iterator find(const Key& key) const {
+    return const_cast<FlatMap*>(this)->find(key);
+  }
+
+  size_t count(const Key& key) const { return find(key) != mData.end() ? 1 : 0; }
+
+  //observations mostly arrive in key order, so this is an append in the common case
+  std::pair<iterator, bool> insert(const value_type& value) {
+    if (mData.empty() || mData.back().first < value.first) {
+      mData.push_back(value);
+      return {std::prev(mData.end()), true};
+    }
+
+    auto it = lowerBound(value.first);
+    if (it != mData.end() && !(value.first < it->first)) {
+      return {it, false};
+    }
+    return {mData.insert(it, value), true};
+  }
+
+  Value& operator[](const Key& key) {
+    auto it = lowerBound(key);
+    if (it == mData.end() || key < it->first) {
+      it = mData.insert(it, {key, Value()});
+    }
+    return it->second;
+  }
+
+  size_t erase(const Key& key) {
+    auto it = find(key);
+    if (it == mData.end()) {
+      return 0;
+    }
+    mData.erase(it);
+    return 1;
+  }
+
+  iterator erase(iterator it) { return mData.erase(it); }
+
+private:
+  iterator lowerBound(const Key& key) {
+    return std::lower_bound(mData.begin(),
+                            mData.end(),
+                            key,
+                            [](const value_type& v, const Key& k) { return v.first < k; });
+  }
+
+  std::vector<value_type> mData;
+};
+
+}  //namespace toy
@@ -0,0 +1,12 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+namespace toy {
+namespace util {
+inline uint64_t steadyNs() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+};  //namespace util
+};  //namespace toy
@@ -58,6 +58,14 @@ double      Config::Vio::reprojectionMEConst   = 1.0;
 double      Config::Vio::standardFocalLength   = 640.0;
 int         Config::Vio::maxIteration          = 10;
 bool        Config::Vio::compareLinearizedDiff = false;
+std::string Config::Vio::solverPrecision       = "double";
+std::string Config::Vio::linearSolver          = "ldlt";
+size_t      Config::Vio::sparseSolverFrames    = 12;
+int         Config::Vio::pcgMaxIteration       = 50;
+double      Config::Vio::pcgTolerance          = 1e-6;
+double      Config::Vio::solverTimeBudget      = 0.0;
+double      Config::Vio::relinearizeThreshold  = 0.0;
+size_t      Config::Vio::solverMaxMapPoints    = 0;
 
 double Config::Solver::basicMinDepth = 0.005;
 double Config::Solver::basicMaxDepth = 140;
@@ -132,6 +140,14 @@ void Config::parseConfig(const std::string& configFile) {
   Vio::standardFocalLength   = vioSolverJson["standardFocalLength"];
   Vio::maxIteration          = vioSolverJson["maxIteration"];
   Vio::compareLinearizedDiff = vioSolverJson["compareLinearizedDiff"];
+  Vio::solverPrecision       = vioSolverJson["solverPrecision"];
+  Vio::linearSolver          = vioSolverJson["linearSolver"];
+  Vio::sparseSolverFrames    = vioSolverJson["sparseSolverFrames"];
+  Vio::pcgMaxIteration       = vioSolverJson["pcgMaxIteration"];
+  Vio::pcgTolerance          = vioSolverJson["pcgTolerance"];
+  Vio::solverTimeBudget      = vioSolverJson["solverTimeBudget"];
+  Vio::relinearizeThreshold  = vioSolverJson["relinearizeThreshold"];
+  Vio::solverMaxMapPoints    = vioSolverJson["solverMaxMapPoints"];
 
   auto basicSolverJson  = json["basicSolver"];
   Solver::basicMinDepth = basicSolverJson["minDepth"];
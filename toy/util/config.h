@@ -49,6 +49,14 @@ public:
     static double      standardFocalLength;
     static int         maxIteration;
     static bool        compareLinearizedDiff;
+    static std::string solverPrecision;
+    static std::string linearSolver;
+    static size_t      sparseSolverFrames;
+    static int         pcgMaxIteration;
+    static double      pcgTolerance;
+    static double      relinearizeThreshold;  //<= 0 relinearizes every landmark
+    static double      solverTimeBudget;  //ms per frame, <= 0 for no limit
+    static size_t      solverMaxMapPoints;  //landmarks handed to the solver, 0 for all
   };
 
   struct Solver {